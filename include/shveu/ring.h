@@ -0,0 +1,216 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __SHVEU_RING_H__
+#define __SHVEU_RING_H__
+
+#include <shveu/shveu.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ * Single producer, single consumer rings of frames, and a worker that
+ * converts the frames of one ring into another.
+ */
+
+/**
+ * An opaque handle to a frame ring.
+ * A ring has a fixed number of slots, each with its own surface that is
+ * set up once with shveu_ring_set_surface(). The producer fills the
+ * surface of the slot returned by shveu_ring_acquire() and passes it on
+ * with shveu_ring_publish(); the consumer takes it with shveu_ring_peek()
+ * and gives it back with shveu_ring_release(). Slots are used in order.
+ * None of these take a lock or make a system call, so exactly one thread
+ * may produce and one thread may consume.
+ */
+struct SHVEU_RING;
+typedef struct SHVEU_RING SHVEU_RING;
+
+/** Create a ring used within this process.
+ * \param nr_slots Number of slots
+ * \retval 0 Failure, otherwise ring
+ */
+SHVEU_RING *
+shveu_ring_new(
+	int nr_slots);
+
+/** Create a ring in shared memory.
+ * The other process opens the ring with shveu_ring_open_shared() using
+ * the file descriptor from shveu_ring_fd(), sent over a UNIX socket.
+ * Surfaces are local to each process, so both sides set the surfaces of
+ * the slots, for example with shveu_surface_import().
+ * \param nr_slots Number of slots
+ * \retval 0 Failure, otherwise ring
+ */
+SHVEU_RING *
+shveu_ring_new_shared(
+	int nr_slots);
+
+/** Open a ring created by another process with shveu_ring_new_shared().
+ * \param fd File descriptor of the ring, which may be closed afterwards
+ * \retval 0 Failure, otherwise ring
+ */
+SHVEU_RING *
+shveu_ring_open_shared(
+	int fd);
+
+/** Get the file descriptor of a shared ring.
+ * \param ring Ring
+ * \retval -1 The ring is not shared, otherwise file descriptor owned by the ring
+ */
+int
+shveu_ring_fd(
+	SHVEU_RING *ring);
+
+/** Free a ring.
+ * A shared ring remains valid in other processes that have it open.
+ * \param ring Ring
+ */
+void
+shveu_ring_free(
+	SHVEU_RING *ring);
+
+/** Get the number of slots of a ring.
+ * \param ring Ring
+ * \returns Number of slots
+ */
+int
+shveu_ring_slots(
+	SHVEU_RING *ring);
+
+/** Set the surface of a slot.
+ * This should be done before the ring is used. The surface buffers should
+ * be uiomux memory, so that the VEU can use them without a copy.
+ * \param ring Ring
+ * \param slot Slot, from 0 to shveu_ring_slots() - 1
+ * \param surface Surface, copied
+ */
+void
+shveu_ring_set_surface(
+	SHVEU_RING *ring,
+	int slot,
+	const struct ren_vid_surface *surface);
+
+/** Get the surface of a slot.
+ * \param ring Ring
+ * \param slot Slot
+ * \retval 0 The slot is out of range, otherwise surface
+ */
+const struct ren_vid_surface *
+shveu_ring_surface(
+	SHVEU_RING *ring,
+	int slot);
+
+/** Producer: get the next empty slot to fill.
+ * \param ring Ring
+ * \retval -1 The ring is full, otherwise slot
+ */
+int
+shveu_ring_acquire(
+	SHVEU_RING *ring);
+
+/** Producer: pass the slot from shveu_ring_acquire() to the consumer.
+ * \param ring Ring
+ * \param data Passed with the frame, e.g. a timestamp
+ */
+void
+shveu_ring_publish(
+	SHVEU_RING *ring,
+	unsigned long long data);
+
+/** Consumer: get the next filled slot.
+ * \param ring Ring
+ * \param data If not NULL, set to the data passed to shveu_ring_publish()
+ * \retval -1 The ring is empty, otherwise slot
+ */
+int
+shveu_ring_peek(
+	SHVEU_RING *ring,
+	unsigned long long *data);
+
+/** Consumer: give the slot from shveu_ring_peek() back to the producer.
+ * \param ring Ring
+ */
+void
+shveu_ring_release(
+	SHVEU_RING *ring);
+
+/**
+ * An opaque handle to a ring conversion worker.
+ */
+struct SHVEU_RING_WORKER;
+typedef struct SHVEU_RING_WORKER SHVEU_RING_WORKER;
+
+/** Ring conversion worker statistics */
+struct shveu_ring_stats {
+	unsigned long converted;	/**< Frames converted */
+	unsigned long failed;		/**< Frames that could not be converted, and were skipped */
+};
+
+/** Start a thread that converts frames from one ring into another.
+ * The worker is the consumer of the input ring and the producer of the
+ * output ring. Each input frame is converted with shveu_rotate() into the
+ * next output slot and published with the same data. When the output ring
+ * is full, the worker waits for the consumer. While frames are flowing,
+ * the worker polls the rings without sleeping; when they stop, it backs
+ * off to sleeping up to a millisecond at a time.
+ *
+ * \param veu VEU handle, which must not be used otherwise while the worker exists
+ * \param in Input ring
+ * \param out Output ring
+ * \param filter_control VEU filter mode
+ * \retval 0 Failure, otherwise worker
+ */
+SHVEU_RING_WORKER *
+shveu_ring_worker_new(
+	SHVEU *veu,
+	SHVEU_RING *in,
+	SHVEU_RING *out,
+	shveu_rotation_t filter_control);
+
+/** Stop and free a ring conversion worker.
+ * A conversion in progress is finished first.
+ * \param worker Worker
+ */
+void
+shveu_ring_worker_free(
+	SHVEU_RING_WORKER *worker);
+
+/** Get the statistics of a ring conversion worker.
+ * \param worker Worker
+ * \param stats Set to the statistics
+ */
+void
+shveu_ring_worker_stats(
+	SHVEU_RING_WORKER *worker,
+	struct shveu_ring_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SHVEU_RING_H__ */
@@ -0,0 +1,258 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SHVEU_SCHED_H__
+#define __SHVEU_SCHED_H__
+
+#include <shveu/shveu.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \file
+ * Job scheduler: queues of scale/rotate jobs shared by several VEUs.
+ */
+
+/**
+ * An opaque handle to a job scheduler.
+ */
+struct SHVEU_SCHED;
+typedef struct SHVEU_SCHED SHVEU_SCHED;
+
+/** Job priority classes */
+typedef enum {
+	SHVEU_PRIO_BULK = 0,	/**< Background work, e.g. thumbnails */
+	SHVEU_PRIO_NORMAL,	/**< Default */
+	SHVEU_PRIO_REALTIME,	/**< Display or capture bound, runs first */
+} shveu_prio_t;
+
+#define SHVEU_NR_PRIO (SHVEU_PRIO_REALTIME + 1)
+
+/** Set the priority of the operations of a VEU handle.
+ * This only has an effect when the operations are sent to the shveud
+ * daemon, i.e. when the handle was opened with SHVEU_DAEMON set in the
+ * environment. Operations from all clients of the daemon then share its
+ * scheduler queues.
+ * \param veu VEU handle
+ * \param prio Priority class, SHVEU_PRIO_NORMAL by default
+ */
+void
+shveu_set_priority(
+	SHVEU *veu,
+	shveu_prio_t prio);
+
+/** Set the deadline of the next operation of a VEU handle.
+ * As with shveu_set_priority(), this only has an effect when the operation
+ * is sent to shveud. The daemon drops the operation if it can't be done
+ * in time, and shveu_wait() then returns -1. The deadline is cleared when
+ * the operation is started.
+ * \param veu VEU handle
+ * \param deadline_us Deadline in CLOCK_MONOTONIC microseconds, or 0 for none
+ */
+void
+shveu_set_deadline(
+	SHVEU *veu,
+	long long deadline_us);
+
+/** Job completion status */
+typedef enum {
+	SHVEU_JOB_FAILED = -1,	/**< The operation failed */
+	SHVEU_JOB_DONE = 0,	/**< The operation completed in time */
+	SHVEU_JOB_LATE,		/**< The operation completed after the deadline */
+	SHVEU_JOB_DROPPED,	/**< Not run, it could not meet the deadline */
+} shveu_job_status_t;
+
+/**
+ * An opaque handle to a completion fence.
+ * A fence is signalled when the job it is attached to is finished with,
+ * or by shveu_fence_signal() for work done outside the scheduler. Jobs
+ * that wait on fences are only started once all of them are signalled,
+ * so chains of jobs run without the application in between.
+ */
+struct SHVEU_FENCE;
+typedef struct SHVEU_FENCE SHVEU_FENCE;
+
+/** Maximum number of fences a job can wait on */
+#define SHVEU_MAX_WAIT_FENCES 4
+
+/** A scale/rotate job */
+struct shveu_job {
+	struct ren_vid_surface src;	/**< Input surface */
+	struct ren_vid_surface dst;	/**< Output surface */
+	shveu_rotation_t filter_control; /**< VEU filter mode */
+	shveu_prio_t prio;		/**< Priority class */
+	long long deadline_us;		/**< Deadline in CLOCK_MONOTONIC microseconds, or 0 for none */
+	int bt709;			/**< YCbCr colour conversion, see shveu_set_color_conversion() */
+	int full_range;			/**< YCbCr range, see shveu_set_color_conversion() */
+
+	/** Called from a scheduler thread when the job is finished with */
+	void (*done)(void *data, shveu_job_status_t status);
+	void *data;			/**< Passed to done */
+
+	/** Fences that must be signalled before the job is started, NULL if
+	 * unused. If any of them failed, the job is dropped. */
+	SHVEU_FENCE *wait[SHVEU_MAX_WAIT_FENCES];
+	/** Signalled when the job is finished with, after done is called;
+	 * it fails unless the job completed. NULL if unused. */
+	SHVEU_FENCE *signal;
+};
+
+/** Scheduler statistics */
+struct shveu_sched_stats {
+	unsigned long submitted;	/**< Jobs submitted */
+	unsigned long completed;	/**< Jobs completed, including late ones */
+	unsigned long late;		/**< Jobs completed after their deadline */
+	unsigned long dropped;		/**< Jobs dropped before they were run */
+	unsigned long failed;		/**< Jobs that failed */
+};
+
+/** Create a job scheduler.
+ * Each VEU is driven by its own thread, which takes the next job from the
+ * highest priority queue that has one. Within a priority class, jobs with
+ * the earliest deadline run first, then jobs without a deadline in the
+ * order they were submitted. Before a job is run, its duration is
+ * estimated from recent jobs on the same VEU, and it is dropped if it
+ * would finish after its deadline.
+ * Priorities only order the jobs of this scheduler; other processes using
+ * the VEUs still take turns through the uiomux lock.
+ *
+ * \param veus Array of VEU handles, which must not be used directly while
+ *        the scheduler exists. A NULL handle completes its jobs without
+ *        doing anything, to test the scheduling without a VEU.
+ * \param nr_veus Number of VEU handles
+ * \retval 0 Failure, otherwise scheduler
+ */
+SHVEU_SCHED *
+shveu_sched_new(
+	SHVEU **veus,
+	int nr_veus);
+
+/** Free a job scheduler.
+ * Jobs that have not started are dropped, and running jobs are waited for.
+ * \param sched Scheduler
+ */
+void
+shveu_sched_free(
+	SHVEU_SCHED *sched);
+
+/** Submit a job.
+ * The job is copied, but the surface buffers must remain valid until the
+ * done callback is called.
+ *
+ * \param sched Scheduler
+ * \param job Job
+ * \retval 0 Success
+ * \retval -1 Error: out of memory
+ */
+int
+shveu_sched_submit(
+	SHVEU_SCHED *sched,
+	const struct shveu_job *job);
+
+/** Wait until all submitted jobs are finished with.
+ * Jobs waiting on a fence that is signalled outside the scheduler are
+ * waited for too. To give up on such a fence, fail it with
+ * shveu_fence_signal() or free it, which drops the jobs that wait on it.
+ * \param sched Scheduler
+ */
+void
+shveu_sched_flush(
+	SHVEU_SCHED *sched);
+
+/** Get the statistics of a scheduler.
+ * \param sched Scheduler
+ * \param stats Set to the statistics
+ */
+void
+shveu_sched_stats(
+	SHVEU_SCHED *sched,
+	struct shveu_sched_stats *stats);
+
+/** Create a fence for the jobs of a scheduler.
+ * \param sched Scheduler
+ * \retval 0 Failure, otherwise fence
+ */
+SHVEU_FENCE *
+shveu_fence_new(
+	SHVEU_SCHED *sched);
+
+/** Free a fence.
+ * Queued jobs that wait on the fence are dropped unless it was signalled,
+ * and queued jobs that would signal it no longer do.
+ * \param fence Fence, which no running job may signal
+ */
+void
+shveu_fence_free(
+	SHVEU_FENCE *fence);
+
+/** Clear a fence, so that it can be used for the next job.
+ * \param fence Fence
+ */
+void
+shveu_fence_reset(
+	SHVEU_FENCE *fence);
+
+/** Signal a fence from outside the scheduler, e.g. when a capture is done.
+ * \param fence Fence
+ * \param failed Non-zero to fail the fence, dropping the jobs that wait on it
+ */
+void
+shveu_fence_signal(
+	SHVEU_FENCE *fence,
+	int failed);
+
+/** Get the state of a fence without waiting.
+ * \param fence Fence
+ * \retval 0 Not signalled
+ * \retval 1 Signalled
+ * \retval -1 Failed
+ */
+int
+shveu_fence_status(
+	SHVEU_FENCE *fence);
+
+/** Wait for a fence to be signalled.
+ * \param fence Fence
+ * \retval 0 Signalled
+ * \retval -1 Failed
+ */
+int
+shveu_fence_wait(
+	SHVEU_FENCE *fence);
+
+/** Get a file descriptor that is readable while the fence is signalled
+ * or failed, for use with poll() or select(). Don't read from it.
+ * \param fence Fence
+ * \retval -1 Not available, otherwise file descriptor owned by the fence
+ */
+int
+shveu_fence_fd(
+	SHVEU_FENCE *fence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SHVEU_SCHED_H__ */
@@ -41,7 +41,8 @@ extern "C" {
  *
  * \subsection contents Contents
  *
- * - \link shveu.h shveu.h \endlink, \link veu_colorspace.h veu_colorspace.h \endlink:
+ * - \link shveu.h shveu.h \endlink, \link veu_colorspace.h veu_colorspace.h \endlink,
+ * \link sched.h sched.h \endlink, \link ring.h ring.h \endlink:
  * Documentation of the SHVEU C API
  *
  * - \link configuration Configuration \endlink:
@@ -149,6 +150,8 @@ void shveu_close(SHVEU *veu);
 int shveu_list_veu(char ***names, int *count);
 
 #include <shveu/veu_colorspace.h>
+#include <shveu/sched.h>
+#include <shveu/ring.h>
 
 #ifdef __cplusplus
 }
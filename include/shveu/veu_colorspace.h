@@ -26,6 +26,8 @@
 #ifndef __REN_VIDEO_BUFFER_H__
 #define __REN_VIDEO_BUFFER_H__
 
+#include <stddef.h>
+
 /* Notes on YUV/YCbCr:
  * YUV historically refers to analogue color space, and YCbCr to digital.
  * The formula used to convert to/from RGB is BT.601 or BT.709. HDTV specifies
@@ -45,6 +47,13 @@ typedef enum {
 	REN_BGR24,   /**< Packed BGR888 */
 	REN_RGB32,   /**< Packed XRGB8888 (most significant byte ignored) */
 	REN_ARGB32,  /**< Packed ARGB8888 */
+	REN_I420,    /**< YCbCr420: Y plane, Cb plane, Cr plane */
+	REN_YV12,    /**< YCbCr420: Y plane, Cr plane, Cb plane */
+	REN_YUYV,    /**< YCbCr422: Packed Y0 Cb Y1 Cr */
+	REN_UYVY,    /**< YCbCr422: Packed Cb Y0 Cr Y1 */
+	REN_NV21,    /**< YCbCr420: Y plane, packed CrCb plane, optional alpha plane */
+	REN_NV61,    /**< YCbCr422: Y plane, packed CrCb plane, optional alpha plane */
+	REN_Y8,      /**< Luma only: Y plane, optional alpha plane */
 } ren_vid_format_t;
 
 
@@ -64,7 +73,9 @@ struct ren_vid_surface {
 	int pitch;  /**< Width of surface in pixels */
 	void *py;   /**< Address of Y or RGB plane */
 	void *pc;   /**< Address of CbCr plane (ignored for RGB) */
-	void *pa;   /**< Address of Alpha plane (ignored) */
+	void *pa;   /**< Address of Alpha plane (optional, ignored for ARGB) */
+	void *pcr;  /**< Address of Cr plane (planar formats only, pc is then the Cb plane).
+	             *   Only read for planar formats; set it to 0 for other formats */
 };
 
 struct format_info {
@@ -86,12 +97,51 @@ static const struct format_info fmts[] = {
 	{ REN_BGR24,   3, 0, 0, 1, 1, 1 },
 	{ REN_RGB32,   4, 0, 0, 1, 1, 1 },
 	{ REN_ARGB32,  4, 0, 0, 1, 1, 1 },
+	{ REN_I420,    1, 1, 1, 2, 2, 2 },
+	{ REN_YV12,    1, 1, 1, 2, 2, 2 },
+	{ REN_YUYV,    2, 0, 0, 1, 2, 1 },
+	{ REN_UYVY,    2, 0, 0, 1, 2, 1 },
+	{ REN_NV21,    1, 2, 1, 2, 2, 2 },
+	{ REN_NV61,    1, 2, 1, 1, 2, 1 },
+	{ REN_Y8,      1, 0, 0, 1, 1, 1 },
 };
 
+/* Separate Cb and Cr planes */
+static inline int is_planar(ren_vid_format_t fmt)
+{
+	if (fmt >= REN_I420 && fmt <= REN_YV12)
+		return 1;
+	return 0;
+}
+
+/* Luma and chroma packed into a single plane */
+static inline int is_packed_ycbcr(ren_vid_format_t fmt)
+{
+	if (fmt >= REN_YUYV && fmt <= REN_UYVY)
+		return 1;
+	return 0;
+}
+
+/* Semi-planar with Cr before Cb */
+static inline int is_crcb(ren_vid_format_t fmt)
+{
+	if (fmt >= REN_NV21 && fmt <= REN_NV61)
+		return 1;
+	return 0;
+}
+
 static inline int is_ycbcr(ren_vid_format_t fmt)
 {
 	if (fmt >= REN_NV12 && fmt <= REN_NV16)
 		return 1;
+	if (is_planar(fmt))
+		return 1;
+	if (is_packed_ycbcr(fmt))
+		return 1;
+	if (is_crcb(fmt))
+		return 1;
+	if (fmt == REN_Y8)
+		return 1;
 	return 0;
 }
 
@@ -164,18 +214,49 @@ static inline void get_sel_surface(
 	const struct ren_vid_surface *in,
 	const struct ren_vid_rect *sel)
 {
-	int x = sel->x & ~horz_increment(in->format);
-	int y = sel->y & ~vert_increment(in->format);
+	int x = sel->x & ~(horz_increment(in->format) - 1);
+	int y = sel->y & ~(vert_increment(in->format) - 1);
 
 	*out = *in;
-	out->w = sel->w & ~horz_increment(in->format);
-	out->h = sel->h & ~vert_increment(in->format);
+	out->w = sel->w & ~(horz_increment(in->format) - 1);
+	out->h = sel->h & ~(vert_increment(in->format) - 1);
 
 	if (in->py) out->py += offset_y(in->format, x, y, in->pitch);
 	if (in->pc) out->pc += offset_c(in->format, x, y, in->pitch);
+	if (is_planar(in->format) && in->pcr)
+		out->pcr += offset_c(in->format, x, y, in->pitch);
 	if (in->pa) out->pa += offset_a(in->format, x, y, in->pitch);
 }
 
+/** Field of an interlaced surface */
+typedef enum {
+	REN_FIELD_TOP = 0,   /**< Even lines */
+	REN_FIELD_BOTTOM,    /**< Odd lines */
+} ren_vid_field_t;
+
+/* Get a surface descriptor for one field of an interlaced surface. This is
+ * a view with double the pitch, so nothing is copied. For 4:2:0 formats,
+ * the chroma lines alternate between fields just like the luma lines. */
+static inline void get_field_surface(
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in,
+	ren_vid_field_t field)
+{
+	*out = *in;
+	out->h = (in->h / 2) & ~(vert_increment(in->format) - 1);
+	out->pitch = in->pitch * 2;
+
+	if (field == REN_FIELD_BOTTOM) {
+		int c_line = vert_increment(in->format);
+
+		if (in->py) out->py += offset_y(in->format, 0, 1, in->pitch);
+		if (in->pc) out->pc += offset_c(in->format, 0, c_line, in->pitch);
+		if (is_planar(in->format) && in->pcr)
+			out->pcr += offset_c(in->format, 0, c_line, in->pitch);
+		if (in->pa) out->pa += offset_a(in->format, 0, 1, in->pitch);
+	}
+}
+
 #endif /* __REN_VIDEO_BUFFER_H__ */
 
 
@@ -186,6 +267,7 @@ static inline void get_sel_surface(
 #ifndef __VEU_COLORSPACE_H__
 #define __VEU_COLORSPACE_H__
 
+#include <stdint.h>
 
 /** Rotation */
 typedef enum {
@@ -195,13 +277,23 @@ typedef enum {
 
 /** Setup a (scale|rotate) & crop between YCbCr & RGB surfaces
  * The scaling factor is calculated from the surface sizes.
+ * If the output has alpha (REN_ARGB32 or an alpha plane), the alpha is
+ * scaled/rotated by the CPU in shveu_wait() while the VEU processes the
+ * colour. Alpha is taken from the input, or is opaque if it has none.
+ * Copies that don't change the size (including crops and conversions
+ * between YCbCr layouts) are done by the CPU in shveu_wait() and don't
+ * lock the VEU.
+ * The output may use the same memory as the input (e.g. to downscale or
+ * convert RGB32 to RGB565 in place) if the VEU reads each part of the
+ * input before it writes over it. Otherwise an error is returned.
  *
  * \param veu VEU handle
  * \param src_surface Input surface
  * \param dst_surface Output surface
  * \param rotate Rotation to apply
  * \retval 0 Success
- * \retval -1 Error: Attempt to perform simultaneous scaling and rotation
+ * \retval -1 Error: Attempt to perform simultaneous scaling and rotation,
+ *                   or output overwrites input before it is read
  */
 int
 shveu_setup(
@@ -211,6 +303,25 @@ shveu_setup(
 	shveu_rotation_t rotate);
 
 
+/** Setup a copy between surfaces of the same format and size.
+ * Large copies between buffers that the VEU can access are done by the VEU,
+ * leaving the CPU free between shveu_start() and shveu_wait(). Small copies,
+ * where the VEU setup cost would dominate, are done by the CPU in
+ * shveu_wait(). Use get_sel_surface() to copy rectangles between surfaces.
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \retval 0 Success
+ * \retval -1 Error: Surfaces differ in format or size
+ */
+int
+shveu_setup_blit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface);
+
+
 /** Set the source addresses. This is typically used for bundle mode.
  * \param veu VEU handle
  * \param src_py Address of Y or RGB plane of source image
@@ -284,10 +395,52 @@ shveu_start_bundle(
 
 /** Wait for a VEU operation to complete. The operation is started by a call to shveu_start.
  * \param veu VEU handle
+ * \retval 1 The operation is complete
+ * \retval 0 The bundle is complete, but not the operation
+ * \retval -1 Error: the VEU timed out and was reset (see shveu_set_timeout()),
+ *         shveud failed the operation, or there was no memory to scale the
+ *         alpha of the output
  */
 int
 shveu_wait(SHVEU *veu);
 
+/** VEU hang statistics */
+struct shveu_hang_stats {
+	unsigned long timeouts;		/**< Operations that didn't finish in time */
+	unsigned long retries;		/**< Operations restarted after a timeout */
+	unsigned long failed;		/**< Operations that failed after all retries */
+	unsigned long stuck_resets;	/**< Software resets that didn't stop the VEU */
+	long long last_us;		/**< CLOCK_MONOTONIC microseconds of the last event, 0 if none */
+};
+
+/** Bound the time shveu_wait() and the blocking operations wait for the VEU.
+ * Without a timeout, shveu_wait() sleeps until the VEU interrupt, however
+ * long that takes. With a timeout, it polls the VEU status instead, which
+ * adds up to a millisecond of latency. If the VEU has not finished by the
+ * timeout, it is reset and the operation is started again from the same
+ * registers, up to retries times. If it still doesn't finish, the VEU is
+ * reset, the uiomux lock is released and shveu_wait() returns -1. Each
+ * event is counted in the hang statistics.
+ *
+ * \param veu VEU handle
+ * \param timeout_ms Timeout of each attempt in milliseconds, or 0 for none (default)
+ * \param retries Number of times to restart an operation that timed out
+ */
+void
+shveu_set_timeout(
+	SHVEU *veu,
+	int timeout_ms,
+	int retries);
+
+/** Get the hang statistics of a VEU handle.
+ * \param veu VEU handle
+ * \param stats Set to the statistics
+ */
+void
+shveu_hang_stats(
+	SHVEU *veu,
+	struct shveu_hang_stats *stats);
+
 
 /** Perform scale between YCbCr & RGB surfaces.
  * This operates on entire surfaces and blocks until completion.
@@ -304,6 +457,588 @@ shveu_resize(
 	const struct ren_vid_surface *src_surface,
 	const struct ren_vid_surface *dst_surface);
 
+/** Setup a scale of one field of an interlaced input.
+ * The field is read in place through a view with double the pitch (see
+ * get_field_surface()), so the fields don't have to be separated first.
+ * An output of the full frame height scales the field to full height
+ * (bob) in the same pass. The fields are not shifted relative to each
+ * other. Start and wait for the operation as for shveu_setup().
+ *
+ * \param veu VEU handle
+ * \param src_surface Interlaced input surface
+ * \param dst_surface Output surface
+ * \param field Field of the input to use
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_setup_field(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	ren_vid_field_t field);
+
+/** Perform scale of one field of an interlaced input.
+ * As shveu_setup_field(), but blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Interlaced input surface
+ * \param dst_surface Output surface
+ * \param field Field of the input to use
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_resize_field(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	ren_vid_field_t field);
+
+/** Deinterlace by scaling each field of the input to a full frame (bob).
+ * Both fields are processed with the lock held. This blocks until
+ * completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Interlaced input surface
+ * \param dst_top Output surface for the top field
+ * \param dst_bottom Output surface for the bottom field
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_bob(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_top,
+	const struct ren_vid_surface *dst_bottom);
+
+/** Perform scale between YCbCr & RGB surfaces, allowing the output to be
+ * a view of the input.
+ * If the surfaces have the same format and size (e.g. the input is a
+ * selection made with get_sel_surface()), the pitch and plane addresses of
+ * the output surface are replaced with those of the input and nothing is
+ * copied. Otherwise, this is the same as shveu_resize().
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param dst_surface Output surface, may be changed to a view of the input
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_resize_view(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	struct ren_vid_surface *dst_surface);
+
+/** Copy between surfaces of the same format and size.
+ * This operates on entire surfaces and blocks until completion.
+ * See shveu_setup_blit().
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \retval 0 Success
+ * \retval -1 Error: Surfaces differ in format or size
+ */
+int
+shveu_blit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface);
+
+/** Perform scale from one surface to several output surfaces.
+ * The input is copied to a buffer the VEU can access (if needed) once, and
+ * the lock of each VEU is held for the whole sequence. The outputs are
+ * shared between the given VEUs, largest first; smaller outputs are scaled
+ * from a larger output in the same format as the input where possible, to
+ * read less memory.
+ * This blocks until all outputs are complete.
+ *
+ * \param veus Array of VEU handles
+ * \param nr_veus Number of VEU handles
+ * \param src_surface Input surface
+ * \param dst_surfaces Array of output surfaces
+ * \param nr_dst Number of output surfaces
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters for at least one output
+ */
+int
+shveu_resize_multi(
+	SHVEU **veus,
+	int nr_veus,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surfaces,
+	int nr_dst);
+
+/** A layer of a composition */
+struct shveu_layer {
+	const struct ren_vid_surface *src; /**< Input surface */
+	struct ren_vid_rect dst_rect;      /**< Where the input is scaled to in the output */
+	int z;                             /**< Layers with a higher z are on top */
+};
+
+/** Compose several inputs into one output, e.g. for picture-in-picture or
+ * video walls. Each layer is scaled directly into its rectangle of the
+ * output, using all of the given VEUs concurrently. A layer is only
+ * started once the lower layers that it overlaps are done, so layers that
+ * don't overlap run in parallel. Layers are opaque: the top layer replaces
+ * the pixels below it. Each rectangle must lie within the output, and is
+ * aligned to the chroma subsampling of the output as for a selection.
+ * This blocks until all layers are done.
+ *
+ * \param veus Array of VEU handles
+ * \param nr_veus Number of VEU handles
+ * \param dst_surface Output surface
+ * \param layers Array of layers
+ * \param nr_layers Number of layers
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters, a layer outside the output,
+ *                   or a layer failed
+ */
+int
+shveu_compose(
+	SHVEU **veus,
+	int nr_veus,
+	const struct ren_vid_surface *dst_surface,
+	const struct shveu_layer *layers,
+	int nr_layers);
+
+/** Maximum number of levels in an image pyramid */
+#define SHVEU_PYRAMID_MAX_LEVELS 8
+
+/** Image pyramid: successive half size copies of an image, all held in one
+ * buffer that the VEU can access. */
+struct shveu_pyramid {
+	int nr_levels;    /**< Number of levels */
+	struct ren_vid_surface level[SHVEU_PYRAMID_MAX_LEVELS]; /**< level[0] is half the source size */
+	void *mem;        /**< Buffer holding all levels (internal) */
+	size_t size;      /**< Size of buffer (internal) */
+};
+
+/** Allocate an image pyramid.
+ * The levels are 1/2, 1/4, 1/8... of the given size. Fewer levels than
+ * requested are created if they would become too small. The levels use the
+ * format the VEU operates on for the given format (e.g. NV12 for I420).
+ *
+ * \param veu VEU handle
+ * \param format Format of the source images
+ * \param w Width of the source images
+ * \param h Height of the source images
+ * \param nr_levels Number of levels
+ * \retval 0 Failure, otherwise pyramid
+ */
+struct shveu_pyramid *
+shveu_pyramid_new(
+	SHVEU *veu,
+	ren_vid_format_t format,
+	int w,
+	int h,
+	int nr_levels);
+
+/** Free an image pyramid.
+ * \param veu VEU handle used to allocate the pyramid
+ * \param pyramid Pyramid
+ */
+void
+shveu_pyramid_free(
+	SHVEU *veu,
+	struct shveu_pyramid *pyramid);
+
+/** Generate all levels of an image pyramid.
+ * Each level is scaled from the previous one, so every pass is a 1/2
+ * downscale and reads a quarter of the data of the one before it. The lock
+ * is held for all levels. This blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param pyramid Pyramid allocated for the size of the input
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_pyramid_run(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	struct shveu_pyramid *pyramid);
+
+/** Crop many regions from one surface and scale each to its own output.
+ * The input is copied to a buffer the VEU can access once, the lock is
+ * held for the whole sequence, and each region after the first only
+ * rewrites the registers that differ (addresses, sizes and scale) where
+ * the formats allow it. The outputs can be separate buffers or views into
+ * one packed buffer. This blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param rois Array of regions of the input
+ * \param nr_rois Number of regions
+ * \param dst_surfaces Array of nr_rois output surfaces
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters, or a region failed
+ */
+int
+shveu_resize_rois(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_rect *rois,
+	int nr_rois,
+	const struct ren_vid_surface *dst_surfaces);
+
+/** Update only the parts of an output affected by changes to the input.
+ * Each damaged rectangle of the input is mapped to the output through the
+ * scale, padded by the filter footprint and aligned to the chroma
+ * sampling. Overlapping results are merged and only those regions are
+ * converted. If most of the output is affected, the whole surface is
+ * converted instead. The regions are scaled individually, so the updated
+ * pixels may differ by a fraction of a pixel from a full conversion.
+ * This blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param dst_surface Output surface, holding the previous conversion
+ * \param damage Array of changed rectangles in input coordinates
+ * \param nr_damage Number of changed rectangles
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_resize_damage(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *damage,
+	int nr_damage);
+
+/** Perform the same scale on many small surfaces in one VEU pass.
+ * The inputs must all have the same format and size. They are copied side
+ * by side into an atlas that the VEU can access, which is scaled in a
+ * few passes into the output atlas. The outputs are returned as views
+ * into the output atlas.
+ * Each pass uses one scale step for all of its tiles, so the sampling of a
+ * tile drifts from scaling it on its own, more so the further the tile is
+ * from the start of the pass. A pass is limited to the tiles for which the
+ * drift stays under half an output pixel, as well as by the VEU size
+ * limits; when the scale is far from an exact ratio, this may be a single
+ * tile per pass. The drift that remains is a sub-pixel shift. As the tiles
+ * of a pass are filtered as one image, pixels at the edges of each output
+ * may also be blended slightly with the neighbouring output. Outputs
+ * are laid out left to right, then top to bottom, and the unused part of
+ * the last row of the output atlas may be overwritten.
+ * This blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param src_surfaces Array of input surfaces
+ * \param nr_src Number of input surfaces
+ * \param dst_atlas Output atlas surface, see shveu_batch_atlas_height()
+ * \param dst_w Width of each output
+ * \param dst_h Height of each output
+ * \param dst_surfaces Array of nr_src surfaces, set to views of the outputs
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters, or the atlas is too small
+ */
+int
+shveu_resize_batch(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surfaces,
+	int nr_src,
+	const struct ren_vid_surface *dst_atlas,
+	int dst_w,
+	int dst_h,
+	struct ren_vid_surface *dst_surfaces);
+
+/** Get the minimum size of the output atlas for shveu_resize_batch().
+ * \param nr Number of outputs
+ * \param atlas_w Width of the output atlas
+ * \param dst_w Width of each output
+ * \param dst_h Height of each output
+ * \retval Minimum height of the output atlas, or -1 if atlas_w is too small
+ */
+int
+shveu_batch_atlas_height(
+	int nr,
+	int atlas_w,
+	int dst_w,
+	int dst_h);
+
+/** Surface to collect statistics of */
+typedef enum {
+	SHVEU_STATS_SRC = 0, /**< Input surface */
+	SHVEU_STATS_DST,     /**< Output surface */
+} shveu_stats_t;
+
+/** Surface statistics */
+struct shveu_stats {
+	unsigned long hist[256];      /**< Luma histogram */
+	unsigned long long sum[3];    /**< Sum of Y, Cb & Cr, or R, G & B */
+	unsigned long nr_pixels;      /**< Number of luma samples */
+	unsigned long nr_chroma;      /**< Number of samples in sum[1] & sum[2] */
+	int min;                      /**< Minimum luma */
+	int max;                      /**< Maximum luma */
+	unsigned long long activity;  /**< Sum of the luma range of each 8x8 block */
+	unsigned long nr_blocks;      /**< Number of blocks in activity */
+};
+
+/** Collect statistics of the input or output of each operation.
+ * The statistics are collected while the CPU copies the surface to or from
+ * a buffer the VEU can access, a band of rows at a time, so the surface is
+ * read once. If no copy is needed, the surface is read just for this. For
+ * RGB, luma is approximated as (77R + 150G + 29B) / 256. The statistics
+ * are valid when shveu_wait() reports completion; they are not collected
+ * in bundle mode.
+ *
+ * \param veu VEU handle
+ * \param stats Statistics to fill in for each operation, or NULL to stop
+ * \param surface Surface to collect statistics of
+ */
+void
+shveu_set_stats(
+	SHVEU *veu,
+	struct shveu_stats *stats,
+	shveu_stats_t surface);
+
+/** Export a surface as a file descriptor for another process.
+ * The surface buffers must be uiomux memory. The returned file holds the
+ * format, size, pitch and the physical address and offsets of the planes,
+ * not the pixel data, and is sealed against changes where the kernel
+ * supports memfd. Pass it to another process over a UNIX socket
+ * (SCM_RIGHTS) and use shveu_surface_import() there. The buffers must stay
+ * allocated while any process uses the imported surface; the caller
+ * closes the descriptor.
+ *
+ * \param veu VEU handle
+ * \param s Surface
+ * \retval >=0 File descriptor
+ * \retval -1 Error: the planes do not lie wholly within the uiomux memory
+ *                   of the VEU, or no file could be created
+ */
+int
+shveu_surface_export(
+	SHVEU *veu,
+	const struct ren_vid_surface *s);
+
+/** Import a surface exported by shveu_surface_export().
+ * The planes are mapped through the uiomux memory of this process, so the
+ * VEU reads and writes them directly, without a copy. The descriptor can
+ * be closed afterwards.
+ *
+ * \param veu VEU handle
+ * \param fd File descriptor from shveu_surface_export()
+ * \param surface Set to the surface
+ * \retval 0 Success
+ * \retval -1 Error: not a surface handle, or the planes do not lie wholly
+ *                   within uiomux memory mapped in this process
+ */
+int
+shveu_surface_import(
+	SHVEU *veu,
+	int fd,
+	struct ren_vid_surface *surface);
+
+/** Fill a rectangle of a surface with a colour.
+ * For YCbCr surfaces, the colour is converted with the colour settings of
+ * the VEU (see shveu_set_color_conversion()), or BT.601 limited range if
+ * no VEU is given. Any alpha plane is set to the alpha of the colour.
+ * The rectangle is clipped to the surface.
+ *
+ * \param veu VEU handle, or NULL
+ * \param dst_surface Surface
+ * \param rect Rectangle to fill, aligned to the chroma sampling
+ * \param argb Colour as 0xAARRGGBB
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_fill_rect(
+	SHVEU *veu,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *rect,
+	uint32_t argb);
+
+/** Fill the parts of a surface outside a rectangle with a colour.
+ * This is used to clear the borders around a scaled image without
+ * writing the pixels that the image covers.
+ *
+ * \param veu VEU handle, or NULL
+ * \param dst_surface Surface
+ * \param inner Rectangle that is not filled, which may extend past the
+ *        edges of the surface
+ * \param argb Colour as 0xAARRGGBB
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_fill_border(
+	SHVEU *veu,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *inner,
+	uint32_t argb);
+
+/** How an input is fitted to an output of a different aspect ratio */
+typedef enum {
+	SHVEU_FIT = 0,	/**< Show all of the input, with borders (letterbox) */
+	SHVEU_FILL,	/**< Cover all of the output, cropping the input */
+	SHVEU_STRETCH,	/**< Scale the input to the output, ignoring aspect */
+} shveu_fit_t;
+
+/** Get the input and output selections that fit an input to an output.
+ * The selections are centred and aligned to the chroma sampling of each
+ * surface.
+ *
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \param mode How the input is fitted to the output
+ * \param src_sel Set to the selection of the input
+ * \param dst_sel Set to the selection of the output
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_fit_rects(
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_fit_t mode,
+	struct ren_vid_rect *src_sel,
+	struct ren_vid_rect *dst_sel);
+
+/** Scale an input to an output, keeping the aspect ratio of the input.
+ * The selections are as per shveu_fit_rects(). Only the borders of the
+ * output are filled, while the VEU is scaling. This blocks until
+ * completion.
+ *
+ * \param veu VEU handle
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \param mode How the input is fitted to the output
+ * \param border Colour of the borders as 0xAARRGGBB
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_fit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_fit_t mode,
+	uint32_t border);
+
+/** Conversion cache, see shveu_cache_new() */
+struct shveu_cache;
+
+/** Conversion cache statistics */
+struct shveu_cache_stats {
+	unsigned long hits;      /**< Conversions served from the cache */
+	unsigned long misses;    /**< Conversions run on the VEU */
+	unsigned long evictions; /**< Entries freed to stay within the budget */
+	int entries;             /**< Number of cached outputs */
+	size_t used;             /**< Bytes used by cached outputs */
+	size_t budget;           /**< Maximum bytes used by cached outputs */
+};
+
+/** Create a conversion cache.
+ * The cache holds copies of recent outputs, keyed by a hash of the input
+ * planes and the operation. Sampling only hashes every 8th row (and the last
+ * row), which is much cheaper but will miss changes confined to other rows.
+ *
+ * \param budget Maximum bytes of cached outputs, least recently used
+ *        outputs are freed to stay within it
+ * \param sampled Set to hash a subset of the input rows
+ * \retval 0 Failure, otherwise cache
+ */
+struct shveu_cache *
+shveu_cache_new(
+	size_t budget,
+	int sampled);
+
+/** Free a conversion cache.
+ * \param cache Cache
+ */
+void
+shveu_cache_free(
+	struct shveu_cache *cache);
+
+/** Get the statistics of a conversion cache.
+ * \param cache Cache
+ * \param stats Set to the statistics
+ */
+void
+shveu_cache_stats(
+	struct shveu_cache *cache,
+	struct shveu_cache_stats *stats);
+
+/** Scale/rotate a surface, reusing the output of an identical earlier
+ * conversion if there is one in the cache. A miss costs a hash of the
+ * input and a copy of the output in addition to the conversion.
+ * This blocks until completion.
+ *
+ * \param veu VEU handle
+ * \param cache Cache, or NULL to always convert
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \param filter_control VEU filter mode
+ * \retval 0 Success, converted
+ * \retval 1 Success, copied from the cache
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_convert_cached(
+	SHVEU *veu,
+	struct shveu_cache *cache,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t filter_control);
+
+/** A logical context, see shveu_context_new() */
+struct shveu_context;
+
+/** Create a logical context on a VEU.
+ * Each stream of operations that shares a VEU can have its own context.
+ * A context keeps the complete register image of its last operation, so
+ * switching between contexts only writes the registers that differ from
+ * those of the last context run, without a reset, as long as the VEU
+ * still holds that state. Contexts take turns round robin; a context
+ * with a weight of n may run up to n operations in a row while other
+ * contexts are waiting. After each operation, the VEU is held for a
+ * context with turns left for up to 2ms, so that its thread can submit
+ * the next operation; if it doesn't, its turn passes to the next
+ * context.
+ *
+ * \param veu VEU handle
+ * \param weight Number of turns per round, at least 1
+ * \retval 0 Failure, otherwise context
+ */
+struct shveu_context *
+shveu_context_new(
+	SHVEU *veu,
+	int weight);
+
+/** Free a logical context.
+ * \param ctx Context, which must not be running
+ */
+void
+shveu_context_free(
+	struct shveu_context *ctx);
+
+/** Perform a scale/rotate in a logical context.
+ * Waits for the turn of the context, then runs the operation as
+ * shveu_rotate() does. This may be called from several threads, one per
+ * context. This blocks until completion.
+ *
+ * \param ctx Context
+ * \param src_surface Input surface
+ * \param dst_surface Output surface
+ * \param filter_control VEU filter mode
+ * \retval 0 Success
+ * \retval -1 Error: Unsupported parameters
+ */
+int
+shveu_context_run(
+	struct shveu_context *ctx,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t filter_control);
+
 /** Perform rotate between YCbCr & RGB surfaces
  * This operates on entire surfaces and blocks until completion.
  *
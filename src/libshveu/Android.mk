@@ -7,7 +7,13 @@ LOCAL_C_INCLUDES := \
 #LOCAL_CFLAGS := -DDEBUG
 
 LOCAL_SRC_FILES := \
-	veu.c
+	veu.c \
+	veu_convert.c \
+	veu_stats.c \
+	veu_shm.c \
+	sched.c \
+	ring.c \
+	client.c
 
 LOCAL_SHARED_LIBRARIES := libcutils
 
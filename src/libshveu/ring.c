@@ -0,0 +1,429 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Single producer, single consumer frame rings. The producer only writes
+ * the head and the consumer only writes the tail, so the two sides need
+ * memory barriers but no locks, and work the same way whether the ring is
+ * in private or shared memory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shveu/shveu.h"
+#include "veu_shm.h"
+
+#define RING_MAGIC 0x56455552	/* "VEUR" */
+
+/* Keep the head and tail on separate cache lines */
+#define CACHE_LINE 32
+
+/* Most slots a ring can have, so that its size fits in an int */
+#define MAX_SLOTS ((int)(INT_MAX / sizeof(uint64_t)))
+
+/* Polls of an empty or full ring before the worker starts to sleep */
+#define WORKER_SPINS 1000
+#define WORKER_MIN_SLEEP_NS 10000
+#define WORKER_MAX_SLEEP_NS 1000000
+
+/* The part of the ring that is shared by the producer and consumer */
+struct ring_shared {
+	uint32_t magic;
+	uint32_t nr_slots;
+	/* Counts of slots published and released, which wrap around */
+	volatile uint32_t head __attribute__((aligned(CACHE_LINE)));
+	volatile uint32_t tail __attribute__((aligned(CACHE_LINE)));
+	uint64_t data[] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct SHVEU_RING {
+	struct ring_shared *sh;
+	size_t size;
+	int fd;		/* -1 if the ring is not shared */
+	int nr_slots;
+	struct ren_vid_surface *surfaces;
+	/* Last value seen of the other side's count, to avoid reading its
+	 * cache line on every call */
+	uint32_t cached_tail;
+	uint32_t cached_head;
+};
+
+struct SHVEU_RING_WORKER {
+	SHVEU *veu;
+	SHVEU_RING *in;
+	SHVEU_RING *out;
+	shveu_rotation_t filter_control;
+	pthread_t thread;
+	volatile int quit;
+	pthread_mutex_t stats_mutex;
+	struct shveu_ring_stats stats;
+};
+
+static size_t ring_size(int nr_slots)
+{
+	return sizeof(struct ring_shared) + nr_slots * sizeof(uint64_t);
+}
+
+static SHVEU_RING *ring_alloc(int nr_slots)
+{
+	SHVEU_RING *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->fd = -1;
+	ring->nr_slots = nr_slots;
+	ring->size = ring_size(nr_slots);
+	ring->surfaces = calloc(nr_slots, sizeof(*ring->surfaces));
+	if (!ring->surfaces) {
+		free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+static void ring_init(SHVEU_RING *ring)
+{
+	ring->sh->nr_slots = ring->nr_slots;
+	ring->sh->head = 0;
+	ring->sh->tail = 0;
+	__sync_synchronize();
+	ring->sh->magic = RING_MAGIC;
+}
+
+SHVEU_RING *shveu_ring_new(int nr_slots)
+{
+	SHVEU_RING *ring;
+
+	if (nr_slots <= 0 || nr_slots > MAX_SLOTS)
+		return NULL;
+
+	ring = ring_alloc(nr_slots);
+	if (!ring)
+		return NULL;
+
+	if (posix_memalign((void **)&ring->sh, CACHE_LINE, ring->size) != 0) {
+		free(ring->surfaces);
+		free(ring);
+		return NULL;
+	}
+	memset(ring->sh, 0, ring->size);
+	ring_init(ring);
+
+	return ring;
+}
+
+SHVEU_RING *shveu_ring_new_shared(int nr_slots)
+{
+	SHVEU_RING *ring;
+	void *p;
+	int sealable;
+
+	if (nr_slots <= 0 || nr_slots > MAX_SLOTS)
+		return NULL;
+
+	ring = ring_alloc(nr_slots);
+	if (!ring)
+		return NULL;
+
+	ring->fd = veu_shm_create("shveu-ring", &sealable);
+	if (ring->fd < 0)
+		goto err;
+	if (ftruncate(ring->fd, ring->size) < 0)
+		goto err;
+
+	p = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (p == MAP_FAILED)
+		goto err;
+	ring->sh = p;
+	ring_init(ring);
+
+	return ring;
+
+err:
+	if (ring->fd >= 0)
+		close(ring->fd);
+	free(ring->surfaces);
+	free(ring);
+	return NULL;
+}
+
+SHVEU_RING *shveu_ring_open_shared(int fd)
+{
+	struct ring_shared hdr;
+	SHVEU_RING *ring;
+	struct stat st;
+	void *p;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != RING_MAGIC)
+		return NULL;
+	if (hdr.nr_slots == 0 || hdr.nr_slots > MAX_SLOTS)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)ring_size(hdr.nr_slots))
+		return NULL;
+
+	ring = ring_alloc(hdr.nr_slots);
+	if (!ring)
+		return NULL;
+
+	ring->fd = dup(fd);
+	if (ring->fd < 0)
+		goto err;
+
+	p = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (p == MAP_FAILED) {
+		close(ring->fd);
+		goto err;
+	}
+	ring->sh = p;
+	ring->cached_head = ring->sh->head;
+	ring->cached_tail = ring->sh->tail;
+
+	return ring;
+
+err:
+	free(ring->surfaces);
+	free(ring);
+	return NULL;
+}
+
+int shveu_ring_fd(SHVEU_RING *ring)
+{
+	return ring->fd;
+}
+
+void shveu_ring_free(SHVEU_RING *ring)
+{
+	if (!ring)
+		return;
+
+	if (ring->fd >= 0) {
+		munmap(ring->sh, ring->size);
+		close(ring->fd);
+	} else {
+		free(ring->sh);
+	}
+	free(ring->surfaces);
+	free(ring);
+}
+
+int shveu_ring_slots(SHVEU_RING *ring)
+{
+	return ring->nr_slots;
+}
+
+void
+shveu_ring_set_surface(
+	SHVEU_RING *ring,
+	int slot,
+	const struct ren_vid_surface *surface)
+{
+	if (slot >= 0 && slot < ring->nr_slots)
+		ring->surfaces[slot] = *surface;
+}
+
+const struct ren_vid_surface *
+shveu_ring_surface(
+	SHVEU_RING *ring,
+	int slot)
+{
+	if (slot < 0 || slot >= ring->nr_slots)
+		return NULL;
+	return &ring->surfaces[slot];
+}
+
+int shveu_ring_acquire(SHVEU_RING *ring)
+{
+	uint32_t head = ring->sh->head;
+
+	if (head - ring->cached_tail >= (uint32_t)ring->nr_slots) {
+		ring->cached_tail = ring->sh->tail;
+		if (head - ring->cached_tail >= (uint32_t)ring->nr_slots)
+			return -1;
+	}
+
+	/* Don't touch the slot before the consumer has finished with it */
+	__sync_synchronize();
+
+	return head % ring->nr_slots;
+}
+
+void shveu_ring_publish(SHVEU_RING *ring, unsigned long long data)
+{
+	uint32_t head = ring->sh->head;
+
+	ring->sh->data[head % ring->nr_slots] = data;
+
+	/* The frame and its data must be visible before the slot is */
+	__sync_synchronize();
+	ring->sh->head = head + 1;
+}
+
+int shveu_ring_peek(SHVEU_RING *ring, unsigned long long *data)
+{
+	uint32_t tail = ring->sh->tail;
+
+	if (tail == ring->cached_head) {
+		ring->cached_head = ring->sh->head;
+		if (tail == ring->cached_head)
+			return -1;
+	}
+
+	/* Don't read the slot before it was published */
+	__sync_synchronize();
+
+	if (data)
+		*data = ring->sh->data[tail % ring->nr_slots];
+
+	return tail % ring->nr_slots;
+}
+
+void shveu_ring_release(SHVEU_RING *ring)
+{
+	uint32_t tail = ring->sh->tail;
+
+	/* Finish with the slot before the producer can reuse it */
+	__sync_synchronize();
+	ring->sh->tail = tail + 1;
+}
+
+/* Wait a little longer each time nothing can be done */
+static void backoff(int *idle)
+{
+	struct timespec ts;
+	long ns;
+
+	if (++(*idle) < WORKER_SPINS)
+		return;
+
+	ns = WORKER_MIN_SLEEP_NS << ((*idle - WORKER_SPINS) < 7 ? (*idle - WORKER_SPINS) : 7);
+	if (ns > WORKER_MAX_SLEEP_NS)
+		ns = WORKER_MAX_SLEEP_NS;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = ns;
+	nanosleep(&ts, NULL);
+}
+
+static void *worker_thread(void *arg)
+{
+	SHVEU_RING_WORKER *w = arg;
+	unsigned long long data;
+	int in_slot, out_slot;
+	int idle = 0;
+
+	while (!w->quit) {
+		in_slot = shveu_ring_peek(w->in, &data);
+		if (in_slot < 0) {
+			backoff(&idle);
+			continue;
+		}
+
+		out_slot = shveu_ring_acquire(w->out);
+		if (out_slot < 0) {
+			backoff(&idle);
+			continue;
+		}
+		idle = 0;
+
+		if (shveu_rotate(w->veu, shveu_ring_surface(w->in, in_slot),
+				shveu_ring_surface(w->out, out_slot), w->filter_control) < 0) {
+			pthread_mutex_lock(&w->stats_mutex);
+			w->stats.failed++;
+			pthread_mutex_unlock(&w->stats_mutex);
+		} else {
+			shveu_ring_publish(w->out, data);
+			pthread_mutex_lock(&w->stats_mutex);
+			w->stats.converted++;
+			pthread_mutex_unlock(&w->stats_mutex);
+		}
+		shveu_ring_release(w->in);
+	}
+
+	return NULL;
+}
+
+SHVEU_RING_WORKER *
+shveu_ring_worker_new(
+	SHVEU *veu,
+	SHVEU_RING *in,
+	SHVEU_RING *out,
+	shveu_rotation_t filter_control)
+{
+	SHVEU_RING_WORKER *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->veu = veu;
+	w->in = in;
+	w->out = out;
+	w->filter_control = filter_control;
+	pthread_mutex_init(&w->stats_mutex, NULL);
+
+	if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+		pthread_mutex_destroy(&w->stats_mutex);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+void shveu_ring_worker_free(SHVEU_RING_WORKER *w)
+{
+	if (!w)
+		return;
+
+	w->quit = 1;
+	pthread_join(w->thread, NULL);
+	pthread_mutex_destroy(&w->stats_mutex);
+	free(w);
+}
+
+void
+shveu_ring_worker_stats(
+	SHVEU_RING_WORKER *w,
+	struct shveu_ring_stats *stats)
+{
+	pthread_mutex_lock(&w->stats_mutex);
+	*stats = w->stats;
+	pthread_mutex_unlock(&w->stats_mutex);
+}
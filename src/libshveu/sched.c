@@ -0,0 +1,543 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Job scheduler. Each VEU has a worker thread that takes jobs from the
+ * priority queues, so that real-time jobs overtake bulk jobs and jobs that
+ * can't meet their deadline are dropped before any VEU time is spent.
+ * Jobs that wait on fences stay queued, and are passed over, until the
+ * fences are signalled, or dropped once a fence fails or is freed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "shveu/shveu.h"
+
+struct job_node {
+	struct job_node *next;
+	struct shveu_job job;
+	unsigned long seq;
+	int failed;	/* a fence it waited on was freed unsignalled */
+};
+
+struct worker {
+	SHVEU_SCHED *sched;
+	SHVEU *veu;
+	pthread_t thread;
+	unsigned long ns_per_kpixel;	/* estimated cost, 0 until measured */
+};
+
+struct SHVEU_SCHED {
+	pthread_mutex_t mutex;
+	pthread_cond_t work;	/* a job was queued, or quit */
+	pthread_cond_t idle;	/* a job was finished with */
+	struct job_node *queue[SHVEU_NR_PRIO];
+	unsigned long seq;
+	int nr_queued;
+	int nr_running;
+	int quit;
+	int nr_workers;
+	struct worker *workers;
+	struct shveu_sched_stats stats;
+};
+
+enum {
+	FENCE_PENDING = 0,
+	FENCE_SIGNALLED = 1,
+	FENCE_FAILED = -1,
+};
+
+/* Fences are protected by the scheduler mutex, and waited for on the idle
+ * condition, which is broadcast whenever a fence changes */
+struct SHVEU_FENCE {
+	SHVEU_SCHED *sched;
+	int state;
+	int fd;		/* eventfd, -1 if not available */
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Earliest deadline first, then jobs without a deadline in order */
+static int runs_before(const struct job_node *a, const struct job_node *b)
+{
+	if (a->job.deadline_us && b->job.deadline_us)
+		return a->job.deadline_us < b->job.deadline_us;
+	if (a->job.deadline_us || b->job.deadline_us)
+		return a->job.deadline_us != 0;
+	return a->seq < b->seq;
+}
+
+static void enqueue(SHVEU_SCHED *sched, struct job_node *node)
+{
+	struct job_node **pp = &sched->queue[node->job.prio];
+
+	while (*pp && !runs_before(node, *pp))
+		pp = &(*pp)->next;
+	node->next = *pp;
+	*pp = node;
+	sched->nr_queued++;
+}
+
+/* FENCE_PENDING if the job must still wait, FENCE_FAILED if it can't run */
+static int job_fences(const struct job_node *node)
+{
+	const struct shveu_job *job = &node->job;
+	int state = FENCE_SIGNALLED;
+	int i;
+
+	if (node->failed)
+		return FENCE_FAILED;
+
+	for (i=0; i<SHVEU_MAX_WAIT_FENCES; i++) {
+		if (!job->wait[i])
+			continue;
+		if (job->wait[i]->state == FENCE_FAILED)
+			return FENCE_FAILED;
+		if (job->wait[i]->state == FENCE_PENDING)
+			state = FENCE_PENDING;
+	}
+	return state;
+}
+
+/* Take the first job that isn't waiting on a fence. If all is set, take
+ * any job, for when the scheduler is being freed. */
+static struct job_node *dequeue(SHVEU_SCHED *sched, int all)
+{
+	int prio;
+
+	for (prio=SHVEU_NR_PRIO-1; prio>=0; prio--) {
+		struct job_node **pp = &sched->queue[prio];
+
+		while (*pp && !all && job_fences(*pp) == FENCE_PENDING)
+			pp = &(*pp)->next;
+		if (*pp) {
+			struct job_node *node = *pp;
+			*pp = node->next;
+			sched->nr_queued--;
+			return node;
+		}
+	}
+	return NULL;
+}
+
+/* Empty the eventfd counter, making it unreadable. EAGAIN means it is
+ * already empty. */
+static void clear_fd(int fd)
+{
+	uint64_t count;
+	ssize_t n;
+
+	do {
+		n = read(fd, &count, sizeof(count));
+	} while (n < 0 && errno == EINTR);
+}
+
+/* Make the eventfd readable. EAGAIN means the counter is full, which can
+ * only happen if it was written to from outside, so empty it and retry.
+ * Any other error means fd is not an eventfd, and nothing can be done. */
+static void signal_fd(int fd)
+{
+	uint64_t one = 1;
+	ssize_t n;
+
+	for (;;) {
+		n = write(fd, &one, sizeof(one));
+		if (n == sizeof(one))
+			break;
+		if (n < 0 && errno == EAGAIN)
+			clear_fd(fd);
+		else if (n >= 0 || errno != EINTR)
+			break;
+	}
+}
+
+/* Called with the scheduler mutex held */
+static void set_fence(SHVEU_FENCE *fence, int state)
+{
+	if (fence->state == FENCE_PENDING && fence->fd >= 0)
+		signal_fd(fence->fd);
+	fence->state = state;
+
+	/* Jobs waiting on the fence may now run */
+	pthread_cond_broadcast(&fence->sched->work);
+	pthread_cond_broadcast(&fence->sched->idle);
+}
+
+static long job_kpixels(const struct shveu_job *job)
+{
+	long src = (long)job->src.w * job->src.h;
+	long dst = (long)job->dst.w * job->dst.h;
+
+	return ((src > dst) ? src : dst) / 1000 + 1;
+}
+
+static shveu_job_status_t run_job(struct worker *w, const struct shveu_job *job)
+{
+	long long start = now_us();
+	long long took;
+	unsigned long ns;
+
+	/* Drop the job if it can't be done in time */
+	if (job->deadline_us) {
+		long long estimate = (long long)w->ns_per_kpixel * job_kpixels(job) / 1000;
+		if (start + estimate > job->deadline_us)
+			return SHVEU_JOB_DROPPED;
+	}
+
+	/* No VEU, the job is only being scheduled */
+	if (w->veu) {
+		shveu_set_color_conversion(w->veu, job->bt709, job->full_range);
+		if (shveu_rotate(w->veu, &job->src, &job->dst, job->filter_control) < 0)
+			return SHVEU_JOB_FAILED;
+	}
+
+	/* Running average of the cost */
+	took = now_us() - start;
+	ns = (unsigned long)(took * 1000 / job_kpixels(job));
+	if (w->ns_per_kpixel)
+		w->ns_per_kpixel = (3 * w->ns_per_kpixel + ns) / 4;
+	else
+		w->ns_per_kpixel = ns;
+
+	if (job->deadline_us && now_us() > job->deadline_us)
+		return SHVEU_JOB_LATE;
+	return SHVEU_JOB_DONE;
+}
+
+static void finish_job(SHVEU_SCHED *sched, struct job_node *node, shveu_job_status_t status)
+{
+	if (node->job.done)
+		node->job.done(node->job.data, status);
+
+	pthread_mutex_lock(&sched->mutex);
+	if (status == SHVEU_JOB_DROPPED)
+		sched->stats.dropped++;
+	else if (status == SHVEU_JOB_FAILED)
+		sched->stats.failed++;
+	else
+		sched->stats.completed++;
+	if (status == SHVEU_JOB_LATE)
+		sched->stats.late++;
+	if (node->job.signal) {
+		int ok = (status == SHVEU_JOB_DONE || status == SHVEU_JOB_LATE);
+		set_fence(node->job.signal, ok ? FENCE_SIGNALLED : FENCE_FAILED);
+	}
+	pthread_cond_broadcast(&sched->idle);
+	pthread_mutex_unlock(&sched->mutex);
+
+	free(node);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	SHVEU_SCHED *sched = w->sched;
+
+	pthread_mutex_lock(&sched->mutex);
+	while (!sched->quit) {
+		struct job_node *node = dequeue(sched, 0);
+		shveu_job_status_t status;
+		int fences;
+
+		if (!node) {
+			pthread_cond_wait(&sched->work, &sched->mutex);
+			continue;
+		}
+
+		fences = job_fences(node);
+		sched->nr_running++;
+		pthread_mutex_unlock(&sched->mutex);
+
+		if (fences == FENCE_FAILED)
+			status = SHVEU_JOB_DROPPED;
+		else
+			status = run_job(w, &node->job);
+
+		finish_job(sched, node, status);
+
+		pthread_mutex_lock(&sched->mutex);
+		sched->nr_running--;
+		pthread_cond_broadcast(&sched->idle);
+	}
+	pthread_mutex_unlock(&sched->mutex);
+
+	return NULL;
+}
+
+SHVEU_SCHED *
+shveu_sched_new(
+	SHVEU **veus,
+	int nr_veus)
+{
+	SHVEU_SCHED *sched;
+	int i;
+
+	if (!veus || nr_veus < 1)
+		return NULL;
+
+	sched = calloc(1, sizeof(*sched));
+	if (!sched)
+		return NULL;
+
+	sched->workers = calloc(nr_veus, sizeof(*sched->workers));
+	if (!sched->workers) {
+		free(sched);
+		return NULL;
+	}
+
+	pthread_mutex_init(&sched->mutex, NULL);
+	pthread_cond_init(&sched->work, NULL);
+	pthread_cond_init(&sched->idle, NULL);
+
+	for (i=0; i<nr_veus; i++) {
+		struct worker *w = &sched->workers[i];
+
+		w->sched = sched;
+		w->veu = veus[i];
+		if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+			break;
+		sched->nr_workers++;
+	}
+
+	if (sched->nr_workers == 0) {
+		shveu_sched_free(sched);
+		return NULL;
+	}
+
+	return sched;
+}
+
+void
+shveu_sched_free(
+	SHVEU_SCHED *sched)
+{
+	struct job_node *node;
+	int i;
+
+	if (!sched)
+		return;
+
+	pthread_mutex_lock(&sched->mutex);
+	sched->quit = 1;
+	pthread_cond_broadcast(&sched->work);
+	pthread_mutex_unlock(&sched->mutex);
+
+	for (i=0; i<sched->nr_workers; i++)
+		pthread_join(sched->workers[i].thread, NULL);
+
+	/* The workers have stopped, so no locking is needed */
+	while ((node = dequeue(sched, 1)) != NULL)
+		finish_job(sched, node, SHVEU_JOB_DROPPED);
+
+	pthread_cond_destroy(&sched->idle);
+	pthread_cond_destroy(&sched->work);
+	pthread_mutex_destroy(&sched->mutex);
+	free(sched->workers);
+	free(sched);
+}
+
+int
+shveu_sched_submit(
+	SHVEU_SCHED *sched,
+	const struct shveu_job *job)
+{
+	struct job_node *node;
+
+	if (!sched || !job || job->prio < 0 || job->prio >= SHVEU_NR_PRIO)
+		return -1;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return -1;
+	node->job = *job;
+
+	pthread_mutex_lock(&sched->mutex);
+	node->seq = sched->seq++;
+	enqueue(sched, node);
+	sched->stats.submitted++;
+	pthread_cond_signal(&sched->work);
+	pthread_mutex_unlock(&sched->mutex);
+
+	return 0;
+}
+
+void
+shveu_sched_flush(
+	SHVEU_SCHED *sched)
+{
+	if (!sched)
+		return;
+
+	pthread_mutex_lock(&sched->mutex);
+	while (sched->nr_queued || sched->nr_running)
+		pthread_cond_wait(&sched->idle, &sched->mutex);
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+void
+shveu_sched_stats(
+	SHVEU_SCHED *sched,
+	struct shveu_sched_stats *stats)
+{
+	if (!sched || !stats)
+		return;
+
+	pthread_mutex_lock(&sched->mutex);
+	*stats = sched->stats;
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+SHVEU_FENCE *
+shveu_fence_new(
+	SHVEU_SCHED *sched)
+{
+	SHVEU_FENCE *fence;
+
+	if (!sched)
+		return NULL;
+
+	fence = calloc(1, sizeof(*fence));
+	if (!fence)
+		return NULL;
+
+	fence->sched = sched;
+	fence->state = FENCE_PENDING;
+	fence->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return fence;
+}
+
+/* Called with the scheduler mutex held. Remove a fence from the queued
+ * jobs, failing the jobs that still wait on it. */
+static void release_fence(SHVEU_SCHED *sched, SHVEU_FENCE *fence)
+{
+	struct job_node *node;
+	int prio, i;
+
+	for (prio=0; prio<SHVEU_NR_PRIO; prio++) {
+		for (node=sched->queue[prio]; node; node=node->next) {
+			for (i=0; i<SHVEU_MAX_WAIT_FENCES; i++) {
+				if (node->job.wait[i] != fence)
+					continue;
+				if (fence->state != FENCE_SIGNALLED)
+					node->failed = 1;
+				node->job.wait[i] = NULL;
+			}
+			if (node->job.signal == fence)
+				node->job.signal = NULL;
+		}
+	}
+
+	/* Failed jobs can now be dropped */
+	pthread_cond_broadcast(&sched->work);
+}
+
+void
+shveu_fence_free(
+	SHVEU_FENCE *fence)
+{
+	if (!fence)
+		return;
+
+	pthread_mutex_lock(&fence->sched->mutex);
+	release_fence(fence->sched, fence);
+	pthread_mutex_unlock(&fence->sched->mutex);
+
+	if (fence->fd >= 0)
+		close(fence->fd);
+	free(fence);
+}
+
+void
+shveu_fence_reset(
+	SHVEU_FENCE *fence)
+{
+	pthread_mutex_lock(&fence->sched->mutex);
+	if (fence->state != FENCE_PENDING && fence->fd >= 0)
+		clear_fd(fence->fd);
+	fence->state = FENCE_PENDING;
+	pthread_mutex_unlock(&fence->sched->mutex);
+}
+
+void
+shveu_fence_signal(
+	SHVEU_FENCE *fence,
+	int failed)
+{
+	pthread_mutex_lock(&fence->sched->mutex);
+	set_fence(fence, failed ? FENCE_FAILED : FENCE_SIGNALLED);
+	pthread_mutex_unlock(&fence->sched->mutex);
+}
+
+int
+shveu_fence_status(
+	SHVEU_FENCE *fence)
+{
+	int state;
+
+	pthread_mutex_lock(&fence->sched->mutex);
+	state = fence->state;
+	pthread_mutex_unlock(&fence->sched->mutex);
+
+	return state;
+}
+
+int
+shveu_fence_wait(
+	SHVEU_FENCE *fence)
+{
+	SHVEU_SCHED *sched = fence->sched;
+	int state;
+
+	pthread_mutex_lock(&sched->mutex);
+	while (fence->state == FENCE_PENDING)
+		pthread_cond_wait(&sched->idle, &sched->mutex);
+	state = fence->state;
+	pthread_mutex_unlock(&sched->mutex);
+
+	return (state == FENCE_SIGNALLED) ? 0 : -1;
+}
+
+int
+shveu_fence_fd(
+	SHVEU_FENCE *fence)
+{
+	return fence->fd;
+}
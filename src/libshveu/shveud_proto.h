@@ -0,0 +1,82 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Protocol between libshveu clients and the shveud daemon.
+ *
+ * Clients connect to a UNIX stream socket and send one request per
+ * operation, then read one reply. Buffers are passed as physical
+ * addresses of uiomux memory, which the daemon maps with
+ * uiomux_phys_to_virt(), so no pixel data goes through the socket.
+ */
+
+#ifndef __SHVEUD_PROTO_H__
+#define __SHVEUD_PROTO_H__
+
+#include <stdint.h>
+
+/* Default socket, used if SHVEU_DAEMON is set but empty */
+#define SHVEUD_SOCKET "/tmp/shveud.sock"
+
+#define SHVEUD_MAGIC 0x56455544	/* "VEUD" */
+
+struct shveud_surface {
+	int32_t format;
+	int32_t w;
+	int32_t h;
+	int32_t pitch;
+	uint32_t py;	/* physical addresses, 0 if unused */
+	uint32_t pc;
+	uint32_t pcr;
+	uint32_t pa;
+};
+
+struct shveud_request {
+	uint32_t magic;
+	uint32_t seq;
+	int32_t prio;		/* shveu_prio_t */
+	int32_t filter_control;
+	int32_t bt709;
+	int32_t full_range;
+	int64_t deadline_us;	/* CLOCK_MONOTONIC, 0 for none */
+	struct shveud_surface src;
+	struct shveud_surface dst;
+};
+
+struct shveud_reply {
+	uint32_t magic;
+	uint32_t seq;
+	int32_t status;		/* shveu_job_status_t */
+};
+
+/* Client side, in client.c */
+int shveud_connect(const char *path);
+int shveud_send(int fd, const struct shveud_request *req);
+int shveud_recv(int fd, struct shveud_reply *reply);
+
+/* Read or write all of a message, retrying on EINTR */
+int shveud_read_all(int fd, void *buf, size_t len);
+int shveud_write_all(int fd, const void *buf, size_t len);
+
+#endif /* __SHVEUD_PROTO_H__ */
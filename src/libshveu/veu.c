@@ -33,13 +33,21 @@
 #endif
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <uiomux/uiomux.h>
 #include "shveu/shveu.h"
 #include "shveu_regs.h"
+#include "veu_convert.h"
+#include "veu_stats.h"
+#include "veu_shm.h"
+#include "shveud_proto.h"
 
 #include <endian.h>
 
@@ -53,6 +61,13 @@
 
 #endif
 
+/* Byte offset of alpha in a REN_ARGB32 pixel */
+#ifdef __LITTLE_ENDIAN__
+#define ARGB32_ALPHA_OFFSET 3
+#else
+#define ARGB32_ALPHA_OFFSET 0
+#endif
+
 /* #define DEBUG 2 */
 
 #ifdef DEBUG
@@ -66,15 +81,30 @@ struct veu_format_info {
 	uint32_t vtrcr_src;
 	uint32_t vtrcr_dst;
 	uint32_t vswpr;
+	ren_vid_format_t hw_fmt;	/* format of the buffer the VEU accesses */
 };
 
 static const struct veu_format_info veu_fmts[] = {
-	{ REN_NV12,   VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7 },
-	{ REN_NV16,   VTRCR_SRC_FMT_YCBCR422, VTRCR_DST_FMT_YCBCR422, 7 },
-	{ REN_RGB565, VTRCR_SRC_FMT_RGB565,   VTRCR_DST_FMT_RGB565,   6 },
-	{ REN_RGB24,  VTRCR_SRC_FMT_RGB888,   VTRCR_DST_FMT_RGB888,   7 },
-	{ REN_BGR24,  VTRCR_SRC_FMT_BGR888,   VTRCR_DST_FMT_BGR888,   7 },
-	{ REN_RGB32,  VTRCR_SRC_FMT_RGBX888,  VTRCR_DST_FMT_RGBX888,  4 },
+	{ REN_NV12,   VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7, REN_NV12 },
+	{ REN_NV16,   VTRCR_SRC_FMT_YCBCR422, VTRCR_DST_FMT_YCBCR422, 7, REN_NV16 },
+	{ REN_RGB565, VTRCR_SRC_FMT_RGB565,   VTRCR_DST_FMT_RGB565,   6, REN_RGB565 },
+	{ REN_RGB24,  VTRCR_SRC_FMT_RGB888,   VTRCR_DST_FMT_RGB888,   7, REN_RGB24 },
+	{ REN_BGR24,  VTRCR_SRC_FMT_BGR888,   VTRCR_DST_FMT_BGR888,   7, REN_BGR24 },
+	{ REN_RGB32,  VTRCR_SRC_FMT_RGBX888,  VTRCR_DST_FMT_RGBX888,  4, REN_RGB32 },
+	{ REN_ARGB32, VTRCR_SRC_FMT_RGBX888,  VTRCR_DST_FMT_RGBX888,  4, REN_ARGB32 },
+
+	/* The VEU treats these as CbCr, see resolve_chroma_order() */
+	{ REN_NV21,   VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7, REN_NV21 },
+	{ REN_NV61,   VTRCR_SRC_FMT_YCBCR422, VTRCR_DST_FMT_YCBCR422, 7, REN_NV61 },
+
+	/* The VEU is run as YCbCr420 with the chroma plane in a scratch buffer */
+	{ REN_Y8,     VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7, REN_Y8 },
+
+	/* Converted by the CPU while copying to/from a buffer the VEU can access */
+	{ REN_I420,   VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7, REN_NV12 },
+	{ REN_YV12,   VTRCR_SRC_FMT_YCBCR420, VTRCR_DST_FMT_YCBCR420, 7, REN_NV12 },
+	{ REN_YUYV,   VTRCR_SRC_FMT_YCBCR422, VTRCR_DST_FMT_YCBCR422, 7, REN_NV16 },
+	{ REN_UYVY,   VTRCR_SRC_FMT_YCBCR422, VTRCR_DST_FMT_YCBCR422, 7, REN_NV16 },
 };
 
 struct uio_map {
@@ -83,6 +113,9 @@ struct uio_map {
 	void *iomem;
 };
 
+/* Size of the register image of a logical context */
+#define VEU_REG_WORDS ((VCBR / 4) + 1)
+
 struct SHVEU {
 	UIOMux *uiomux;
 	uiomux_resource_t uiores;
@@ -93,6 +126,58 @@ struct SHVEU {
 	struct ren_vid_surface dst_hw;
 	int bt709;
 	int full_range;
+
+	/* Alpha is processed by the CPU while the VEU processes the colour */
+	int alpha_op;
+	int alpha_done;
+	int alpha_failed;	/* out of memory, the alpha is not written */
+	int filter_control;
+	int cpu_op;	/* The operation is a copy done by the CPU */
+	int hold_lock;	/* The lock is held across several operations */
+	struct veu_alpha alpha_src;
+	struct veu_alpha alpha_dst;
+	uint8_t *alpha_tmp;
+
+	/* Chroma planes used by the VEU for luma only surfaces */
+	struct uio_map scratch_src_c;
+	struct uio_map scratch_dst_c;
+
+	/* Statistics collected while copying */
+	struct shveu_stats *stats;
+	shveu_stats_t stats_surface;
+
+	/* Logical contexts, see shveu_context_new() */
+	void *reg_image;	/* veu_setup() writes here instead of the VEU */
+	pthread_mutex_t ctx_mutex;
+	pthread_cond_t ctx_turn;
+	struct shveu_context *ctx_ring;
+	struct shveu_context *ctx_current;
+	struct shveu_context *ctx_granted;
+	long long ctx_hold_until;	/* ctx_granted is held for its next operation */
+	int ctx_busy;
+	int hw_regs_valid;
+	uint32_t hw_regs[VEU_REG_WORDS];
+
+	/* Operations are sent to shveud rather than run here, see
+	 * shveu_open_named() */
+	int client_fd;
+	uint32_t client_seq;
+	shveu_prio_t prio;
+	long long deadline_us;	/* of the next operation, 0 for none */
+
+	/* Hang recovery, see shveu_set_timeout() */
+	int timeout_ms;
+	int retries;
+	uint32_t start_ier;	/* VEIER & VESTR the operation was started with */
+	uint32_t start_vestr;
+	uint32_t retry_regs[VEU_REG_WORDS];
+	struct shveu_hang_stats hangs;
+};
+
+enum {
+	ALPHA_NONE = 0,
+	ALPHA_SCALE,	/* scale/rotate the source alpha */
+	ALPHA_OPAQUE,	/* source has no alpha */
 };
 
 
@@ -118,7 +203,14 @@ static void dbg(const char *str1, int l, const char *str2, const struct ren_vid_
 static void copy_plane(void *dst, void *src, int bpp, int h, int len, int dst_pitch, int src_pitch)
 {
 	int y;
-	if (src && dst != src) {
+
+	if (src && dst && dst != src && len == src_pitch && len == dst_pitch) {
+		/* Contiguous */
+		memcpy(dst, src, len * bpp * h);
+		return;
+	}
+
+	if (src && dst && dst != src) {
 		for (y=0; y<h; y++) {
 			memcpy(dst, src, len * bpp);
 			src += src_pitch * bpp;
@@ -127,30 +219,191 @@ static void copy_plane(void *dst, void *src, int bpp, int h, int len, int dst_pi
 	}
 }
 
-/* Copy active surface contents - assumes output is big enough */
+/* Bytes per line of the chroma plane(s) */
+static int c_pitch(const struct ren_vid_surface *s)
+{
+	const struct format_info *fmt = &fmts[s->format];
+	return fmt->c_bpp * s->pitch / fmt->c_ss_horz;
+}
+
+/* Copy between planar & semi-planar chroma */
+static void copy_chroma_planar(
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in)
+{
+	const struct format_info *fmt = &fmts[in->format];
+	int h = in->h / fmt->c_ss_vert;
+	int w = in->w / fmt->c_ss_horz;
+	int y;
+
+	for (y=0; y<h; y++) {
+		if (is_planar(in->format)) {
+			void *cb = in->pc + y * c_pitch(in);
+			void *cr = in->pcr + y * c_pitch(in);
+			void *c = out->pc + y * c_pitch(out);
+
+			if (is_crcb(out->format))
+				veu_interleave(c, cr, cb, w);
+			else
+				veu_interleave(c, cb, cr, w);
+		} else {
+			void *cb = out->pc + y * c_pitch(out);
+			void *cr = out->pcr + y * c_pitch(out);
+			void *c = in->pc + y * c_pitch(in);
+
+			if (is_crcb(in->format))
+				veu_deinterleave(cr, cb, c, w);
+			else
+				veu_deinterleave(cb, cr, c, w);
+		}
+	}
+}
+
+/* Copy between packed 4:2:2 & NV16. In memory, YUYV is just the Y and CbCr
+ * rows of NV16 interleaved byte by byte, and UYVY the other way round. */
+static void copy_packed_ycbcr(
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in)
+{
+	int y;
+
+	for (y=0; y<in->h; y++) {
+		void *py_in = in->py + y * size_y(in->format, in->pitch);
+		void *py_out = out->py + y * size_y(out->format, out->pitch);
+
+		if (in->format == REN_YUYV) {
+			veu_deinterleave(py_out, out->pc + y * c_pitch(out), py_in, in->w);
+		} else if (in->format == REN_UYVY) {
+			veu_deinterleave(out->pc + y * c_pitch(out), py_out, py_in, in->w);
+		} else if (out->format == REN_YUYV) {
+			veu_interleave(py_out, py_in, in->pc + y * c_pitch(in), in->w);
+		} else {
+			veu_interleave(py_out, in->pc + y * c_pitch(in), py_in, in->w);
+		}
+	}
+}
+
+/* Copy between CbCr & CrCb semi-planar chroma */
+static void copy_chroma_swap(
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in)
+{
+	const struct format_info *fmt = &fmts[in->format];
+	int h = in->h / fmt->c_ss_vert;
+	int y;
+
+	for (y=0; y<h; y++) {
+		veu_swap_pairs(out->pc + y * c_pitch(out),
+			in->pc + y * c_pitch(in), in->w / fmt->c_ss_horz);
+	}
+}
+
+/* Copy active surface contents - assumes output is big enough.
+ * Where the formats differ, the conversion is done as part of the copy. */
 static void copy_surface(
 	struct ren_vid_surface *out,
 	const struct ren_vid_surface *in)
 {
 	const struct format_info *fmt = &fmts[in->format];
 
+	if (in->format != out->format &&
+	    (is_packed_ycbcr(in->format) || is_packed_ycbcr(out->format))) {
+		copy_packed_ycbcr(out, in);
+		copy_plane(out->pa, in->pa, 1, in->h, in->w, out->pitch, in->pitch);
+		return;
+	}
+
 	copy_plane(out->py, in->py, fmt->y_bpp, in->h, in->w, out->pitch, in->pitch);
 
-	copy_plane(out->pc, in->pc, fmt->c_bpp,
-		in->h/fmt->c_ss_vert,
-		in->w/fmt->c_ss_horz,
-		out->pitch/fmt->c_ss_horz,
-		in->pitch/fmt->c_ss_horz);
+	if (is_planar(in->format) != is_planar(out->format)) {
+		copy_chroma_planar(out, in);
+	} else if (is_crcb(in->format) != is_crcb(out->format)) {
+		copy_chroma_swap(out, in);
+	} else if (is_planar(in->format)) {
+		copy_plane(out->pc, in->pc, fmt->c_bpp,
+			in->h/fmt->c_ss_vert,
+			in->w/fmt->c_ss_horz,
+			out->pitch/fmt->c_ss_horz,
+			in->pitch/fmt->c_ss_horz);
+		copy_plane(out->pcr, in->pcr, fmt->c_bpp,
+			in->h/fmt->c_ss_vert,
+			in->w/fmt->c_ss_horz,
+			out->pitch/fmt->c_ss_horz,
+			in->pitch/fmt->c_ss_horz);
+	} else if (fmt->c_bpp) {
+		copy_plane(out->pc, in->pc, fmt->c_bpp,
+			in->h/fmt->c_ss_vert,
+			in->w/fmt->c_ss_horz,
+			out->pitch/fmt->c_ss_horz,
+			in->pitch/fmt->c_ss_horz);
+	}
 
 	copy_plane(out->pa, in->pa, 1, in->h, in->w, out->pitch, in->pitch);
 }
 
-/* Check/create surface that can be accessed by the hardware */
+/* Rows copied at a time when collecting statistics, small enough that the
+ * rows are still in the cache when the statistics are collected */
+#define STATS_BAND 16
+
+/* Copy a surface, collecting statistics of it if they were requested for
+ * this surface (the input or output of the operation) */
+static void copy_surface_stats(
+	SHVEU *veu,
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in,
+	shveu_stats_t surface)
+{
+	struct veu_stats st;
+	struct ren_vid_rect sel;
+	int y;
+
+	if (!veu->stats || veu->stats_surface != surface
+	    || veu_stats_begin(&st, veu->stats, in->w) < 0) {
+		copy_surface(out, in);
+		return;
+	}
+
+	sel.x = 0;
+	sel.w = in->w;
+	for (y=0; y<in->h; y+=STATS_BAND) {
+		struct ren_vid_surface band_in, band_out;
+
+		sel.y = y;
+		sel.h = (in->h - y < STATS_BAND) ? in->h - y : STATS_BAND;
+		get_sel_surface(&band_in, in, &sel);
+		get_sel_surface(&band_out, out, &sel);
+		copy_surface(&band_out, &band_in);
+		veu_stats_rows(&st, (surface == SHVEU_STATS_DST) ? &band_out : &band_in);
+	}
+
+	veu_stats_end(&st);
+}
+
+/* Size of a surface allocated by get_hw_surface() */
+static size_t hw_surface_size(const struct ren_vid_surface *s)
+{
+	return size_y(s->format, s->h * s->w) + size_c(s->format, s->h * s->w);
+}
+
+/* Can the hardware access the surface buffers directly? */
+static int hw_accessible(const struct ren_vid_surface *s)
+{
+	if (s->py && !uiomux_all_virt_to_phys(s->py))
+		return 0;
+	if (fmts[s->format].c_bpp && s->pc && !uiomux_all_virt_to_phys(s->pc))
+		return 0;
+	return 1;
+}
+
+/* Check/create surface that can be accessed by the hardware.
+ * hw_fmt is the format the hardware will use, if it differs from the
+ * input format the contents are converted when copied. */
 static int get_hw_surface(
 	UIOMux * uiomux,
 	uiomux_resource_t resource,
 	struct ren_vid_surface *out,
-	const struct ren_vid_surface *in)
+	const struct ren_vid_surface *in,
+	ren_vid_format_t hw_fmt)
 {
 	int alloc = 0;
 
@@ -158,23 +411,299 @@ static int get_hw_surface(
 		return 0;
 
 	*out = *in;
-	if (in->py) alloc |= !uiomux_all_virt_to_phys(in->py);
-	if (in->pc) alloc |= !uiomux_all_virt_to_phys(in->pc);
+	alloc = !hw_accessible(in) || (in->format != hw_fmt);
 
 	if (alloc) {
 		/* One of the supplied buffers is not usable by the hardware! */
-		size_t len = size_y(in->format, in->h * in->w);
-		if (in->pc) len += size_c(in->format, in->h * in->w);
+		out->format = hw_fmt;
+		out->pitch = in->w;
+		out->pcr = NULL;
 
-		out->py = uiomux_malloc(uiomux, resource, len, 32);
+		out->py = uiomux_malloc(uiomux, resource, hw_surface_size(out), 32);
 		if (!out->py)
 			return -1;
 
-		if (in->pc) {
-			out->pc = out->py + size_y(in->format, in->h * in->w);
+		out->pc = NULL;
+		if (fmts[out->format].c_bpp) {
+			out->pc = out->py + size_y(out->format, in->h * in->w);
+		}
+	}
+
+	return 0;
+}
+
+static ren_vid_format_t swap_chroma_order(ren_vid_format_t fmt);
+
+/* Can copy_surface() convert between these formats? */
+static int cpu_convertible(ren_vid_format_t in, ren_vid_format_t out)
+{
+	ren_vid_format_t in_hw, out_hw;
+
+	if (in == out)
+		return 1;
+
+	in_hw = fmt_info(in)->hw_fmt;
+	out_hw = fmt_info(out)->hw_fmt;
+
+	/* Packed 4:2:2 is only converted to/from NV16 */
+	if (is_packed_ycbcr(in) || is_packed_ycbcr(out))
+		return (in_hw == out || out_hw == in);
+
+	if (!is_ycbcr(in) || !is_ycbcr(out) || in == REN_Y8 || out == REN_Y8)
+		return 0;
+
+	return (in_hw == out_hw || swap_chroma_order(in_hw) == out_hw);
+}
+
+static void free_hw_surface(
+	SHVEU *veu,
+	struct ren_vid_surface *hw,
+	const struct ren_vid_surface *user)
+{
+	if (hw->py && hw->py != user->py)
+		uiomux_free(veu->uiomux, veu->uiores, hw->py, hw_surface_size(hw));
+	hw->py = NULL;
+}
+
+/* Plane geometry, in bytes */
+struct plane {
+	unsigned char *p;
+	int pitch;	/* bytes per line */
+	int len;	/* bytes per line that are used */
+	int lines;
+};
+
+static int get_plane(struct plane *pl, const struct ren_vid_surface *s, int chroma)
+{
+	const struct format_info *fmt = &fmts[s->format];
+
+	if (!chroma) {
+		pl->p = s->py;
+		pl->pitch = size_y(s->format, s->pitch);
+		pl->len = size_y(s->format, s->w);
+		pl->lines = s->h;
+	} else {
+		pl->p = s->pc;
+		pl->pitch = c_pitch(s);
+		pl->len = fmt->c_bpp * (s->w / fmt->c_ss_horz);
+		pl->lines = s->h / fmt->c_ss_vert;
+	}
+	return (pl->p && pl->len > 0 && pl->lines > 0);
+}
+
+static int planes_overlap(const struct plane *a, const struct plane *b)
+{
+	unsigned char *a_end = a->p + (a->lines - 1) * a->pitch + a->len;
+	unsigned char *b_end = b->p + (b->lines - 1) * b->pitch + b->len;
+
+	return (a->p < b_end && b->p < a_end);
+}
+
+/* Check that a VEU pass doesn't overwrite input lines before it reads them.
+ * The VEU reads the input lines that an output line needs before writing
+ * it, and works from top to bottom. When scaling, the line above the
+ * nearest input line may also be needed by the filter. */
+static int in_place_safe(const struct plane *in, const struct plane *out)
+{
+	int margin = (in->lines == out->lines) ? 0 : 1;
+	long r;
+
+	for (r=0; r+1 < out->lines; r++) {
+		/* First input line needed by the next output line */
+		long next;
+		if (in->lines == out->lines)
+			next = r + 1;
+		else
+			next = ((r + 1) * (long long)(in->lines - 1)) / (out->lines - 1);
+		next -= margin;
+
+		if (out->p + r * out->pitch + out->len > in->p + next * in->pitch)
+			return 0;
+	}
+	return 1;
+}
+
+/* Check that the output of a VEU pass can overlap the input.
+ * If filter_control is negative, any overlap is considered unsafe. */
+static int overlap_safe(
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst,
+	int filter_control)
+{
+	struct plane in[2], out[2];
+	int i, j;
+
+	for (i=0; i<2; i++) {
+		if (!get_plane(&in[i], src, i))
+			in[i].p = NULL;
+		if (!get_plane(&out[i], dst, i))
+			out[i].p = NULL;
+	}
+
+	for (i=0; i<2; i++) {
+		for (j=0; j<2; j++) {
+			if (!in[i].p || !out[j].p || !planes_overlap(&in[i], &out[j]))
+				continue;
+
+			/* Rotation & vertical mirroring write out of order, and
+			 * the order of the luma & chroma accesses is unknown */
+			if (filter_control < 0 || (filter_control & ~0x10) || i != j)
+				return 0;
+			if (!in_place_safe(&in[i], &out[j]))
+				return 0;
 		}
 	}
+	return 1;
+}
+
+/* Does the output share memory with the input (other than being the same)? */
+static int partial_overlap(
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	if (src->format == dst->format && src->pitch == dst->pitch
+	    && src->py == dst->py && src->pc == dst->pc)
+		return 0;
+	return !overlap_safe(src, dst, -1);
+}
+
+/* Get the alpha plane or channel of a surface */
+static int get_alpha(struct veu_alpha *a, const struct ren_vid_surface *s)
+{
+	if (s->format == REN_ARGB32) {
+		a->p = s->py + ARGB32_ALPHA_OFFSET;
+		a->pitch = size_y(s->format, s->pitch);
+		a->step = 4;
+	} else if (s->pa) {
+		a->p = s->pa;
+		a->pitch = s->pitch;
+		a->step = 1;
+	} else {
+		return 0;
+	}
+	a->w = s->w;
+	a->h = s->h;
+	return 1;
+}
+
+static int setup_alpha(
+	SHVEU *veu,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	veu->alpha_op = ALPHA_NONE;
+	veu->alpha_done = 0;
+	veu->alpha_failed = 0;
+	veu->alpha_tmp = NULL;
+
+	if (!get_alpha(&veu->alpha_dst, dst))
+		return 0;
+
+	if (get_alpha(&veu->alpha_src, src))
+		veu->alpha_op = ALPHA_SCALE;
+	else
+		veu->alpha_op = ALPHA_OPAQUE;
+
+	/* The VEU writes the alpha byte of packed pixels, so generate alpha
+	 * into a temporary plane and merge it in after the VEU has finished */
+	if (dst->format == REN_ARGB32) {
+		veu->alpha_tmp = malloc(dst->w * dst->h);
+		if (!veu->alpha_tmp)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Process alpha while the VEU is running */
+static void process_alpha(SHVEU *veu)
+{
+	struct veu_alpha tmp = veu->alpha_dst;
+
+	if (veu->alpha_op == ALPHA_NONE || veu->alpha_done)
+		return;
+
+	if (veu->alpha_tmp) {
+		tmp.p = veu->alpha_tmp;
+		tmp.pitch = tmp.w;
+		tmp.step = 1;
+	}
+
+	if (veu->alpha_op == ALPHA_SCALE) {
+		if (veu_scale_alpha(&tmp, &veu->alpha_src, veu->filter_control) < 0)
+			veu->alpha_failed = 1;
+	} else {
+		veu_fill_alpha(&tmp, 0xff);
+	}
 
+	veu->alpha_done = 1;
+}
+
+/* Merge alpha generated in a temporary plane, after the VEU has finished.
+ * Returns -1 if the alpha could not be written. */
+static int finish_alpha(SHVEU *veu)
+{
+	struct veu_alpha tmp = veu->alpha_dst;
+	int ret = veu->alpha_failed ? -1 : 0;
+
+	if (veu->alpha_tmp) {
+		tmp.p = veu->alpha_tmp;
+		tmp.pitch = tmp.w;
+		tmp.step = 1;
+		if (ret == 0 && veu_scale_alpha(&veu->alpha_dst, &tmp, 0) < 0)
+			ret = -1;
+		free(veu->alpha_tmp);
+		veu->alpha_tmp = NULL;
+	}
+	veu->alpha_op = ALPHA_NONE;
+	veu->alpha_failed = 0;
+
+	return ret;
+}
+
+/* Get a hardware buffer that is kept for the lifetime of the handle.
+ * If fill is not negative, new buffers are filled with that value. */
+static void *get_scratch(SHVEU *veu, struct uio_map *scratch, size_t len, int fill)
+{
+	if (scratch->size < len) {
+		if (scratch->iomem)
+			uiomux_free(veu->uiomux, veu->uiores, scratch->iomem, scratch->size);
+		scratch->size = 0;
+		scratch->iomem = uiomux_malloc(veu->uiomux, veu->uiores, len, 32);
+		if (!scratch->iomem)
+			return NULL;
+		scratch->size = len;
+		if (fill >= 0)
+			memset(scratch->iomem, fill, len);
+	}
+	return scratch->iomem;
+}
+
+static void free_scratch(SHVEU *veu, struct uio_map *scratch)
+{
+	if (scratch->iomem)
+		uiomux_free(veu->uiomux, veu->uiores, scratch->iomem, scratch->size);
+	scratch->iomem = NULL;
+	scratch->size = 0;
+}
+
+/* The VEU always processes chroma, for luma only surfaces point it at
+ * scratch buffers so that nothing is allocated or copied per operation.
+ * Luma only input uses neutral chroma, so it can be converted to RGB. */
+static int setup_luma_only(SHVEU *veu, struct ren_vid_surface *src, struct ren_vid_surface *dst)
+{
+	if (src->format == REN_Y8) {
+		size_t len = size_c(REN_NV12, src->pitch * src->h);
+		src->pc = get_scratch(veu, &veu->scratch_src_c, len, 0x80);
+		if (!src->pc)
+			return -1;
+	}
+	if (dst->format == REN_Y8) {
+		size_t len = size_c(REN_NV12, dst->pitch * dst->h);
+		dst->pc = get_scratch(veu, &veu->scratch_dst_c, len, -1);
+		if (!dst->pc)
+			return -1;
+	}
 	return 0;
 }
 
@@ -203,6 +732,45 @@ static void write_reg(void *base_addr, uint32_t value, int reg_nr)
 	*reg = value;
 }
 
+/* Longest wait for a software reset, before relying on the module reset */
+#define RESET_TIMEOUT_US 10000
+
+/* Polling interval while waiting with a timeout */
+#define POLL_MIN_NS 50000
+#define POLL_MAX_NS 1000000
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_hang(SHVEU *veu, unsigned long *counter)
+{
+	(*counter)++;
+	veu->hangs.last_us = now_us();
+}
+
+/* Software reset, waiting a bounded time for the VEU to stop. base_addr
+ * may be a register image rather than the VEU. */
+static void soft_reset(SHVEU *veu, void *base_addr)
+{
+	long long give_up;
+
+	if (read_reg(base_addr, VESTR) & 0x1)
+		write_reg(base_addr, 0, VESTR);
+
+	give_up = now_us() + RESET_TIMEOUT_US;
+	while (read_reg(base_addr, VESTR) & 1) {
+		if (now_us() > give_up) {
+			record_hang(veu, &veu->hangs.stuck_resets);
+			break;
+		}
+	}
+}
+
 static int veu_is_veu2h(SHVEU *veu)
 {
 	/* Is this a VEU2H on SH7723? */
@@ -214,10 +782,65 @@ static int veu_is_veu3f(SHVEU *veu)
 	return veu->uio_mmio.size == 0xcc;
 }
 
-static void set_scale(SHVEU *veu, void *base_addr, int vertical,
-		      int size_in, int size_out, int zoom)
+static ren_vid_format_t swap_chroma_order(ren_vid_format_t fmt)
+{
+	switch (fmt) {
+	case REN_NV12: return REN_NV21;
+	case REN_NV21: return REN_NV12;
+	case REN_NV16: return REN_NV61;
+	case REN_NV61: return REN_NV16;
+	default:       return fmt;
+	}
+}
+
+/* CrCb buffers are accessed by the VEU as if they were CbCr. Where the
+ * swap cancels out or can be absorbed by the colour conversion matrix, the
+ * buffers are used as is. Otherwise, one side uses a CbCr buffer and the
+ * chroma is swapped as part of the copy to/from it.
+ * Note that VSWPR cannot be used, as it applies to the Y plane as well. */
+static void resolve_chroma_order(
+	SHVEU *veu,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst,
+	ren_vid_format_t *src_hw_fmt,
+	ren_vid_format_t *dst_hw_fmt,
+	int *swap_matrix)
+{
+	int src_copied;
+
+	*swap_matrix = 0;
+
+	if (different_colorspace(src->format, dst->format)) {
+		if (is_crcb(*src_hw_fmt)) {
+			/* Only the VEU2H has a programmable matrix */
+			if (veu_is_veu2h(veu))
+				*swap_matrix = 1;
+			else
+				*src_hw_fmt = swap_chroma_order(*src_hw_fmt);
+		}
+		if (is_crcb(*dst_hw_fmt))
+			*dst_hw_fmt = swap_chroma_order(*dst_hw_fmt);
+		return;
+	}
+
+	if (is_crcb(*src_hw_fmt) == is_crcb(*dst_hw_fmt))
+		return;
+
+	/* Swap on the side that is copied by the CPU anyway. Packed 4:2:2 has
+	 * a fixed order when copied, but then the other side can be swapped */
+	src_copied = (src->format != *src_hw_fmt) || !hw_accessible(src);
+	if (!is_packed_ycbcr(src->format) &&
+	    (src_copied || is_packed_ycbcr(dst->format)))
+		*src_hw_fmt = swap_chroma_order(*src_hw_fmt);
+	else
+		*dst_hw_fmt = swap_chroma_order(*dst_hw_fmt);
+}
+
+/* Scale step as programmed into the VEU, input pixels per output pixel
+ * in 4.12 fixed point */
+static uint32_t scale_step(SHVEU *veu, int size_in, int size_out)
 {
-	uint32_t fixpoint, mant, frac, value, vb;
+	uint32_t fixpoint, mant, frac;
 
 	/* calculate FRAC and MANT */
 
@@ -242,6 +865,18 @@ static void set_scale(SHVEU *veu, void *base_addr, int vertical,
 		frac = 0;
 	}
 
+	return (mant << 12) | frac;
+}
+
+static void set_scale(SHVEU *veu, void *base_addr, int vertical,
+		      int size_in, int size_out, int zoom)
+{
+	uint32_t step, mant, frac, value, vb;
+
+	step = scale_step(veu, size_in, size_out);
+	mant = step >> 12;
+	frac = step & 0xfff;
+
 	/* set scale */
 	value = read_reg(base_addr, VRFCR);
 	if (vertical) {
@@ -300,6 +935,17 @@ set_clip(void *base_addr, int vertical, int clip_out)
 	write_reg(base_addr, value, VRFSR);
 }
 
+static int scale_supported(SHVEU *veu, float scale_x, float scale_y)
+{
+	float max = veu_is_veu2h(veu) ? 8.0 : 16.0;
+
+	if ((scale_x > max) || (scale_y > max))
+		return 0;
+	if ((scale_x < 1.0/16.0) || (scale_y < 1.0/16.0))
+		return 0;
+	return 1;
+}
+
 static int format_supported(ren_vid_format_t fmt)
 {
 	const struct veu_format_info *info = fmt_info(fmt);
@@ -311,12 +957,18 @@ static int format_supported(ren_vid_format_t fmt)
 SHVEU *shveu_open_named(const char *name)
 {
 	SHVEU *veu;
+	const char *daemon;
 	int ret;
 
 	veu = calloc(1, sizeof(*veu));
 	if (!veu)
 		goto err;
 
+	pthread_mutex_init(&veu->ctx_mutex, NULL);
+	pthread_cond_init(&veu->ctx_turn, NULL);
+	veu->client_fd = -1;
+	veu->prio = SHVEU_PRIO_NORMAL;
+
 	if (!name) {
 		veu->uiomux = uiomux_open();
 		veu->uiores = UIOMUX_SH_VEU;
@@ -335,6 +987,16 @@ SHVEU *shveu_open_named(const char *name)
 	if (!ret)
 		goto err;
 
+	/* The VEU is still opened for its memory & to identify it */
+	daemon = getenv("SHVEU_DAEMON");
+	if (daemon) {
+		veu->client_fd = shveud_connect(daemon);
+		if (veu->client_fd < 0) {
+			debug_info("ERR: cannot connect to shveud");
+			goto err;
+		}
+	}
+
 	return veu;
 
 err:
@@ -351,8 +1013,15 @@ SHVEU *shveu_open(void)
 void shveu_close(SHVEU *veu)
 {
 	if (veu) {
-		if (veu->uiomux)
+		if (veu->uiomux) {
+			free_scratch(veu, &veu->scratch_src_c);
+			free_scratch(veu, &veu->scratch_dst_c);
 			uiomux_close(veu->uiomux);
+		}
+		if (veu->client_fd >= 0)
+			close(veu->client_fd);
+		pthread_cond_destroy(&veu->ctx_turn);
+		pthread_mutex_destroy(&veu->ctx_mutex);
 		free(veu);
 	}
 }
@@ -399,12 +1068,17 @@ err:
 	return -1;
 }
 
-int
-shveu_setup(
+/* Operations smaller than this are copied by the CPU in shveu_setup_blit()
+ * as the VEU setup & interrupt overhead is greater than the copy. */
+#define BLIT_MIN_SIZE (64 * 1024)
+
+static int
+veu_setup(
 	SHVEU *veu,
 	const struct ren_vid_surface *src_surface,
 	const struct ren_vid_surface *dst_surface,
-	shveu_rotation_t filter_control)
+	shveu_rotation_t filter_control,
+	int allow_cpu)
 {
 	float scale_x, scale_y;
 	uint32_t temp;
@@ -415,6 +1089,10 @@ shveu_setup(
 	struct ren_vid_surface local_dst;
 	struct ren_vid_surface *src = &local_src;
 	struct ren_vid_surface *dst = &local_dst;
+	struct ren_vid_surface src_luma;
+	ren_vid_format_t src_hw_fmt;
+	ren_vid_format_t dst_hw_fmt;
+	int swap_matrix;
 	void *base_addr;
 
 	if (!veu || !src_surface || !dst_surface) {
@@ -422,6 +1100,14 @@ shveu_setup(
 		return -1;
 	}
 
+	/* Luma only output doesn't need the source chroma */
+	if (dst_surface->format == REN_Y8 && is_ycbcr(src_surface->format)
+	    && !is_packed_ycbcr(src_surface->format)) {
+		src_luma = *src_surface;
+		src_luma.format = REN_Y8;
+		src_surface = &src_luma;
+	}
+
 	src_info = fmt_info(src_surface->format);
 	dst_info = fmt_info(dst_surface->format);
 
@@ -437,39 +1123,76 @@ shveu_setup(
 		return -1;
 	}
 
-	/* Scaling limits */
-	if (veu_is_veu2h(veu)) {
-		if ((scale_x > 8.0) || (scale_y > 8.0)) {
-			debug_info("ERR: Outside scaling limits!");
-			return -1;
-		}
-	} else {
-		if ((scale_x > 16.0) || (scale_y > 16.0)) {
-			debug_info("ERR: Outside scaling limits!");
-			return -1;
-		}
+	/* A copy or crop doesn't need the VEU, it's done by the CPU in
+	 * shveu_wait() without taking the lock. */
+	veu->cpu_op = 0;
+	if (allow_cpu && src_surface->w == dst_surface->w && src_surface->h == dst_surface->h
+	    && filter_control == SHVEU_NO_ROT
+	    && cpu_convertible(src_surface->format, dst_surface->format)
+	    && !partial_overlap(src_surface, dst_surface)) {
+		veu->cpu_op = 1;
+		veu->src_user = veu->src_hw = *src_surface;
+		veu->dst_user = veu->dst_hw = *dst_surface;
+		veu->filter_control = 0;
+		return setup_alpha(veu, src_surface, dst_surface);
 	}
-	if ((scale_x < 1.0/16.0) || (scale_y < 1.0/16.0)) {
+
+	if (!scale_supported(veu, scale_x, scale_y)) {
 		debug_info("ERR: Outside scaling limits!");
 		return -1;
 	}
 
+	src_hw_fmt = src_info->hw_fmt;
+	dst_hw_fmt = dst_info->hw_fmt;
+	resolve_chroma_order(veu, src_surface, dst_surface,
+		&src_hw_fmt, &dst_hw_fmt, &swap_matrix);
+
 	/* source - use a buffer the hardware can access */
-	if (get_hw_surface(veu->uiomux, veu->uiores, src, src_surface) < 0) {
+	if (get_hw_surface(veu->uiomux, veu->uiores, src, src_surface, src_hw_fmt) < 0) {
 		debug_info("ERR: src is not accessible by hardware");
 		return -1;
 	}
-	copy_surface(src, src_surface);
+	copy_surface_stats(veu, src, src_surface, SHVEU_STATS_SRC);
 
 	/* destination - use a buffer the hardware can access */
-	if (get_hw_surface(veu->uiomux, veu->uiores, dst, dst_surface) < 0) {
+	if (get_hw_surface(veu->uiomux, veu->uiores, dst, dst_surface, dst_hw_fmt) < 0) {
 		debug_info("ERR: dest is not accessible by hardware");
-		return -1;
+		goto fail_src;
+	}
+
+	/* The output may overwrite the input, e.g. downscaling in place */
+	if (!overlap_safe(src, dst, filter_control)) {
+		debug_info("ERR: dest overwrites src before it is read");
+		goto fail_dst;
+	}
+
+	veu->filter_control = filter_control;
+	if (setup_alpha(veu, src_surface, dst_surface) < 0) {
+		debug_info("ERR: failed to allocate alpha plane");
+		goto fail_dst;
+	}
+
+	/* shveud programs the VEU when the operation is started */
+	if (veu->client_fd >= 0) {
+		veu->src_user = *src_surface;
+		veu->dst_user = *dst_surface;
+		veu->src_hw = local_src;
+		veu->dst_hw = local_dst;
+		return 0;
+	}
+
+	/* shveud has its own chroma for luma only surfaces */
+	if (setup_luma_only(veu, src, dst) < 0) {
+		debug_info("ERR: failed to allocate chroma scratch buffer");
+		goto fail_dst;
 	}
 
-	uiomux_lock (veu->uiomux, veu->uiores);
+	if (!veu->hold_lock)
+		uiomux_lock (veu->uiomux, veu->uiores);
 
-	base_addr = veu->uio_mmio.iomem;
+	base_addr = veu->reg_image ? veu->reg_image : veu->uio_mmio.iomem;
+	if (!veu->reg_image)
+		veu->hw_regs_valid = 0;
 
 	/* Keep track of the requested surfaces */
 	veu->src_user = *src_surface;
@@ -480,10 +1203,7 @@ shveu_setup(
 	veu->dst_hw = local_dst;
 
 	/* Software reset */
-	if (read_reg(base_addr, VESTR) & 0x1)
-		write_reg(base_addr, 0, VESTR);
-	while (read_reg(base_addr, VESTR) & 1)
-		;
+	soft_reset(veu, base_addr);
 
 	/* Clear VEU end interrupt flag */
 	write_reg(base_addr, 0, VEVTR);
@@ -565,7 +1285,7 @@ shveu_setup(
 		temp |= VTRCR_FULL_COLOR_CONV;
 	write_reg(base_addr, temp, VTRCR);
 
-	if (veu_is_veu2h(veu)) {
+	if (veu_is_veu2h(veu) && !swap_matrix) {
 		/* color conversion matrix */
 		write_reg(base_addr, 0x0cc5, VMCR00);
 		write_reg(base_addr, 0x0950, VMCR01);
@@ -577,6 +1297,18 @@ shveu_setup(
 		write_reg(base_addr, 0x0950, VMCR21);
 		write_reg(base_addr, 0x1023, VMCR22);
 		write_reg(base_addr, 0x00800010, VCOFFR);
+	} else if (veu_is_veu2h(veu)) {
+		/* color conversion matrix, Cb & Cr columns swapped for CrCb input */
+		write_reg(base_addr, 0x0000, VMCR00);
+		write_reg(base_addr, 0x0950, VMCR01);
+		write_reg(base_addr, 0x0cc5, VMCR02);
+		write_reg(base_addr, 0x3cdd, VMCR10);
+		write_reg(base_addr, 0x0950, VMCR11);
+		write_reg(base_addr, 0x397f, VMCR12);
+		write_reg(base_addr, 0x1023, VMCR20);
+		write_reg(base_addr, 0x0950, VMCR21);
+		write_reg(base_addr, 0x0000, VMCR22);
+		write_reg(base_addr, 0x00800010, VCOFFR);
 	}
 
 	/* Clipping */
@@ -597,20 +1329,99 @@ shveu_setup(
 
 	return 0;
 
-fail:
-	uiomux_unlock(veu->uiomux, veu->uiores);
+fail_dst:
+	free_hw_surface(veu, dst, dst_surface);
+fail_src:
+	free_hw_surface(veu, src, src_surface);
 	return -1;
 }
 
-void
-shveu_set_src(
+int
+shveu_setup(
 	SHVEU *veu,
-	void *src_py,
-	void *src_pc)
-{
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t filter_control)
+{
+	return veu_setup(veu, src_surface, dst_surface, filter_control, 1);
+}
+
+int
+shveu_setup_blit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface)
+{
+	const struct veu_format_info *info;
+	size_t size;
+
+	if (!veu || !src_surface || !dst_surface) {
+		debug_info("ERR: Invalid input - need src and dest");
+		return -1;
+	}
+
+	info = fmt_info(src_surface->format);
+	if (!info || src_surface->format != dst_surface->format
+	    || src_surface->w != dst_surface->w || src_surface->h != dst_surface->h) {
+		debug_info("ERR: Blit needs surfaces of the same format & size");
+		return -1;
+	}
+
+	/* Use the VEU for large copies it can do without bouncing */
+	size = size_y(src_surface->format, src_surface->w * src_surface->h)
+		+ size_c(src_surface->format, src_surface->w * src_surface->h);
+	if (size >= BLIT_MIN_SIZE && info->hw_fmt == src_surface->format
+	    && hw_accessible(src_surface) && hw_accessible(dst_surface))
+		return veu_setup(veu, src_surface, dst_surface, SHVEU_NO_ROT, 0);
+
+	return veu_setup(veu, src_surface, dst_surface, SHVEU_NO_ROT, 1);
+}
+
+/* Change the buffers of a surface. The Cr plane of planar formats keeps
+ * its offset from the Cb plane. */
+static void set_user_surface(
+	struct ren_vid_surface *user,
+	void *py,
+	void *pc)
+{
+	if (is_planar(user->format) && user->pcr && user->pc && pc)
+		user->pcr = (unsigned char *)pc + ((unsigned char *)user->pcr - (unsigned char *)user->pc);
+	user->py = py;
+	user->pc = pc;
+}
+
+/* Change the buffers of the next operation sent to shveud */
+static void client_set_surface(
+	SHVEU *veu,
+	struct ren_vid_surface *hw,
+	struct ren_vid_surface *user,
+	void *py,
+	void *pc)
+{
+	free_hw_surface(veu, hw, user);
+	set_user_surface(user, py, pc);
+	*hw = *user;
+}
+
+void
+shveu_set_src(
+	SHVEU *veu,
+	void *src_py,
+	void *src_pc)
+{
 	void *base_addr = veu->uio_mmio.iomem;
 	uint32_t Y, C;
 
+	if (veu->cpu_op) {
+		set_user_surface(&veu->src_user, src_py, src_pc);
+		return;
+	}
+
+	if (veu->client_fd >= 0) {
+		client_set_surface(veu, &veu->src_hw, &veu->src_user, src_py, src_pc);
+		return;
+	}
+
 	Y = uiomux_all_virt_to_phys(src_py);
 	C = uiomux_all_virt_to_phys(src_pc);
 	write_reg(base_addr, Y, VSAYR);
@@ -625,6 +1436,21 @@ shveu_set_src_phys(
 {
 	void *base_addr = veu->uio_mmio.iomem;
 
+	/* The copy is done by the CPU, so it needs the virtual addresses */
+	if (veu->cpu_op) {
+		set_user_surface(&veu->src_user,
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, src_py),
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, src_pc));
+		return;
+	}
+
+	if (veu->client_fd >= 0) {
+		client_set_surface(veu, &veu->src_hw, &veu->src_user,
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, src_py),
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, src_pc));
+		return;
+	}
+
 	write_reg(base_addr, src_py, VSAYR);
 	write_reg(base_addr, src_pc, VSACR);
 }
@@ -638,6 +1464,16 @@ shveu_set_dst(
 	void *base_addr = veu->uio_mmio.iomem;
 	uint32_t Y, C;
 
+	if (veu->cpu_op) {
+		set_user_surface(&veu->dst_user, dst_py, dst_pc);
+		return;
+	}
+
+	if (veu->client_fd >= 0) {
+		client_set_surface(veu, &veu->dst_hw, &veu->dst_user, dst_py, dst_pc);
+		return;
+	}
+
 	Y = uiomux_all_virt_to_phys(dst_py);
 	C = uiomux_all_virt_to_phys(dst_pc);
 	write_reg(base_addr, Y, VDAYR);
@@ -652,6 +1488,21 @@ shveu_set_dst_phys(
 {
 	void *base_addr = veu->uio_mmio.iomem;
 
+	/* The copy is done by the CPU, so it needs the virtual addresses */
+	if (veu->cpu_op) {
+		set_user_surface(&veu->dst_user,
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, dst_py),
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, dst_pc));
+		return;
+	}
+
+	if (veu->client_fd >= 0) {
+		client_set_surface(veu, &veu->dst_hw, &veu->dst_user,
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, dst_py),
+			uiomux_phys_to_virt(veu->uiomux, veu->uiores, dst_pc));
+		return;
+	}
+
 	write_reg(base_addr, dst_py, VDAYR);
 	write_reg(base_addr, dst_pc, VDACR);
 }
@@ -667,15 +1518,300 @@ shveu_set_color_conversion(
 }
 
 void
-shveu_start(SHVEU *veu)
+shveu_set_stats(
+	SHVEU *veu,
+	struct shveu_stats *stats,
+	shveu_stats_t surface)
+{
+	veu->stats = stats;
+	veu->stats_surface = surface;
+}
+
+/* Contents of a shared surface handle, see shveu_surface_export() */
+struct shared_surface {
+	uint32_t magic;
+	int32_t format;
+	int32_t w;
+	int32_t h;
+	int32_t pitch;
+	uint32_t phys;		/* physical address of the Y or RGB plane */
+	uint32_t planes;	/* SHARED_* bits, which offsets are valid */
+	int32_t off_c;		/* plane offsets from phys, in bytes */
+	int32_t off_cr;
+	int32_t off_a;
+};
+
+#define SHARED_MAGIC 0x56455553	/* "VEUS" */
+#define SHARED_C  (1 << 0)
+#define SHARED_CR (1 << 1)
+#define SHARED_A  (1 << 2)
+
+/* Anonymous file holding buf, sealed where the kernel supports it */
+static int shared_fd(const void *buf, size_t len)
+{
+	int fd;
+	int sealable;
+
+	fd = veu_shm_create("shveu-surface", &sealable);
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, buf, len) != (ssize_t)len) {
+		close(fd);
+		return -1;
+	}
+
+	if (sealable)
+		veu_shm_seal(fd);
+
+	return fd;
+}
+
+/* Offset of a plane from the Y plane, 0 if the plane is not used */
+static int shared_plane(
+	struct shared_surface *sh,
+	const void *p,
+	uint32_t bit,
+	int32_t *off)
+{
+	unsigned long phys;
+
+	if (!p)
+		return 0;
+
+	phys = uiomux_all_virt_to_phys((void *)p);
+	if (!phys)
+		return -1;
+
+	*off = (int32_t)(phys - sh->phys);
+	sh->planes |= bit;
+	return 0;
+}
+
+/* Map the planes of a shared surface, checking that every plane the VEU
+ * uses is given and lies wholly within the uiomux memory of veu */
+static int shared_map(
+	SHVEU *veu,
+	const struct shared_surface *sh,
+	struct ren_vid_surface *s)
+{
+	size_t len_y, len_c, len_a;
+
+	if (veu_shm_plane_sizes(sh->format, sh->w, sh->h, sh->pitch, &len_y, &len_c, &len_a) < 0)
+		return -1;
+
+	if ((fmts[sh->format].c_bpp && !(sh->planes & SHARED_C))
+	    || (is_planar(sh->format) && !(sh->planes & SHARED_CR)))
+		return -1;
+
+	memset(s, 0, sizeof(*s));
+	s->format = sh->format;
+	s->w = sh->w;
+	s->h = sh->h;
+	s->pitch = sh->pitch;
+
+	s->py = veu_shm_map(veu->uiomux, veu->uiores, sh->phys, len_y);
+	if (sh->planes & SHARED_C)
+		s->pc = veu_shm_map(veu->uiomux, veu->uiores, sh->phys + sh->off_c, len_c);
+	if (sh->planes & SHARED_CR)
+		s->pcr = veu_shm_map(veu->uiomux, veu->uiores, sh->phys + sh->off_cr, len_c);
+	if (sh->planes & SHARED_A)
+		s->pa = veu_shm_map(veu->uiomux, veu->uiores, sh->phys + sh->off_a, len_a);
+
+	if (!s->py
+	    || ((sh->planes & SHARED_C) && !s->pc)
+	    || ((sh->planes & SHARED_CR) && !s->pcr)
+	    || ((sh->planes & SHARED_A) && !s->pa))
+		return -1;
+
+	return 0;
+}
+
+int
+shveu_surface_export(
+	SHVEU *veu,
+	const struct ren_vid_surface *s)
+{
+	struct shared_surface sh;
+	struct ren_vid_surface mapped;
+
+	if (!s || !format_supported(s->format) || !s->py)
+		return -1;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.magic = SHARED_MAGIC;
+	sh.format = s->format;
+	sh.w = s->w;
+	sh.h = s->h;
+	sh.pitch = s->pitch;
+	sh.phys = uiomux_all_virt_to_phys(s->py);
+	if (!sh.phys) {
+		debug_info("ERR: surface is not in uiomux memory");
+		return -1;
+	}
+
+	if ((fmts[s->format].c_bpp && shared_plane(&sh, s->pc, SHARED_C, &sh.off_c) < 0)
+	    || (is_planar(s->format) && shared_plane(&sh, s->pcr, SHARED_CR, &sh.off_cr) < 0)
+	    || shared_plane(&sh, s->pa, SHARED_A, &sh.off_a) < 0) {
+		debug_info("ERR: surface is not in uiomux memory");
+		return -1;
+	}
+
+	/* Only hand out surfaces that can be imported */
+	if (shared_map(veu, &sh, &mapped) < 0) {
+		debug_info("ERR: surface is not in uiomux memory");
+		return -1;
+	}
+
+	return shared_fd(&sh, sizeof(sh));
+}
+
+int
+shveu_surface_import(
+	SHVEU *veu,
+	int fd,
+	struct ren_vid_surface *surface)
+{
+	struct shared_surface sh;
+
+	if (pread(fd, &sh, sizeof(sh), 0) != sizeof(sh) || sh.magic != SHARED_MAGIC)
+		return -1;
+	if (!format_supported(sh.format) || sh.w <= 0 || sh.h <= 0 || sh.pitch < sh.w)
+		return -1;
+
+	/* The buffers are already mapped by uiomux in this process too */
+	if (shared_map(veu, &sh, surface) < 0) {
+		debug_info("ERR: surface is not in uiomux memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+shveu_set_timeout(
+	SHVEU *veu,
+	int timeout_ms,
+	int retries)
+{
+	veu->timeout_ms = (timeout_ms > 0) ? timeout_ms : 0;
+	veu->retries = (retries > 0) ? retries : 0;
+}
+
+void
+shveu_hang_stats(
+	SHVEU *veu,
+	struct shveu_hang_stats *stats)
+{
+	*stats = veu->hangs;
+}
+
+void
+shveu_set_priority(
+	SHVEU *veu,
+	shveu_prio_t prio)
+{
+	veu->prio = prio;
+}
+
+void
+shveu_set_deadline(
+	SHVEU *veu,
+	long long deadline_us)
+{
+	veu->deadline_us = deadline_us;
+}
+
+static void client_surface(struct shveud_surface *out, const struct ren_vid_surface *s)
+{
+	out->format = s->format;
+	out->w = s->w;
+	out->h = s->h;
+	out->pitch = s->pitch;
+	out->py = s->py ? uiomux_all_virt_to_phys(s->py) : 0;
+	out->pc = (fmts[s->format].c_bpp && s->pc) ? uiomux_all_virt_to_phys(s->pc) : 0;
+	out->pcr = (is_planar(s->format) && s->pcr) ? uiomux_all_virt_to_phys(s->pcr) : 0;
+	out->pa = s->pa ? uiomux_all_virt_to_phys(s->pa) : 0;
+}
+
+static void client_start(SHVEU *veu)
+{
+	struct shveud_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = SHVEUD_MAGIC;
+	req.seq = ++veu->client_seq;
+	req.prio = veu->prio;
+	req.deadline_us = veu->deadline_us;
+	veu->deadline_us = 0;
+	req.filter_control = veu->filter_control;
+	req.bt709 = veu->bt709;
+	req.full_range = veu->full_range;
+	client_surface(&req.src, &veu->src_hw);
+	client_surface(&req.dst, &veu->dst_hw);
+
+	if (shveud_send(veu->client_fd, &req) < 0) {
+		debug_info("ERR: failed to send to shveud");
+	}
+}
+
+/* Wait for the reply to the last request, returns 0 when done */
+static int client_wait(SHVEU *veu)
+{
+	struct shveud_reply reply;
+
+	do {
+		if (shveud_recv(veu->client_fd, &reply) < 0) {
+			debug_info("ERR: lost connection to shveud");
+			return -1;
+		}
+	} while (reply.seq != veu->client_seq);
+
+	if (reply.status == SHVEU_JOB_DROPPED) {
+		debug_info("ERR: shveud dropped the operation, it would miss its deadline");
+		return -1;
+	}
+	if (reply.status != SHVEU_JOB_DONE && reply.status != SHVEU_JOB_LATE) {
+		debug_info("ERR: shveud failed the operation");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void save_context(SHVEU *veu, uint32_t *regs);
+static void load_context(SHVEU *veu, const uint32_t *regs);
+
+/* Start the VEU, keeping what is needed to restart it after a hang */
+static void start_hw(SHVEU *veu, uint32_t ier, uint32_t vestr)
 {
 	void *base_addr = veu->uio_mmio.iomem;
 
+	if (veu->timeout_ms) {
+		save_context(veu, veu->retry_regs);
+		veu->start_ier = ier;
+		veu->start_vestr = vestr;
+	}
+
 	/* enable interrupt in VEU */
-	write_reg(base_addr, 1, VEIER);
+	write_reg(base_addr, ier, VEIER);
 
 	/* start operation */
-	write_reg(base_addr, 1, VESTR);
+	write_reg(base_addr, vestr, VESTR);
+}
+
+void
+shveu_start(SHVEU *veu)
+{
+	if (veu->cpu_op)
+		return;
+
+	if (veu->client_fd >= 0) {
+		client_start(veu);
+		return;
+	}
+
+	start_hw(veu, 1, 1);
 }
 
 void
@@ -685,13 +1821,76 @@ shveu_start_bundle(
 {
 	void *base_addr = veu->uio_mmio.iomem;
 
+	/* Alpha is not supported in bundle mode */
+	free(veu->alpha_tmp);
+	veu->alpha_tmp = NULL;
+	veu->alpha_op = ALPHA_NONE;
+
+	/* shveud doesn't do bundles, the whole surface is processed at once */
+	if (veu->client_fd >= 0) {
+		client_start(veu);
+		return;
+	}
+
+	/* The whole surface is copied in shveu_wait() */
+	if (veu->cpu_op)
+		return;
+
 	write_reg(base_addr, bundle_lines, VBSSR);
 
-	/* enable interrupt in VEU */
-	write_reg(base_addr, 0x101, VEIER);
+	start_hw(veu, 0x101, 0x101);
+}
 
-	/* start operation */
-	write_reg(base_addr, 0x101, VESTR);
+/* Wait for the end of the operation or bundle by polling, as uiomux can't
+ * sleep with a timeout. If the VEU doesn't finish in time, it is reset and
+ * the operation restarted from the saved registers, up to veu->retries
+ * times. Returns 0 with the interrupt events, or -1 if the VEU hung. */
+static int wait_timeout(SHVEU *veu, uint32_t *vevtr)
+{
+	void *base_addr = veu->uio_mmio.iomem;
+	struct timespec ts;
+	int attempt;
+
+	for (attempt=0; ; attempt++) {
+		long long give_up = now_us() + veu->timeout_ms * 1000LL;
+		long ns = POLL_MIN_NS;
+
+		while (!(read_reg(base_addr, VEVTR) & 0x101) && now_us() < give_up) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = ns;
+			nanosleep(&ts, NULL);
+			if (ns < POLL_MAX_NS)
+				ns *= 2;
+		}
+
+		if (read_reg(base_addr, VEVTR) & 0x101) {
+			/* Take the interrupt, so that it doesn't end the next wait */
+			uiomux_sleep(veu->uiomux, veu->uiores);
+			*vevtr = read_reg(base_addr, VEVTR);
+			write_reg(base_addr, 0, VEVTR);   /* ack interrupts */
+			return 0;
+		}
+
+		record_hang(veu, &veu->hangs.timeouts);
+		debug_info("ERR: VEU timed out");
+
+		/* The VEU no longer holds the state of any context */
+		veu->hw_regs_valid = 0;
+
+		if (attempt >= veu->retries) {
+			soft_reset(veu, base_addr);
+			write_reg(base_addr, 0, VEVTR);
+			write_reg(base_addr, 0x100, VBSRR);
+			veu->hangs.failed++;
+			return -1;
+		}
+
+		/* Reset, reload the operation and start it again */
+		veu->hangs.retries++;
+		load_context(veu, veu->retry_regs);
+		write_reg(base_addr, veu->start_ier, VEIER);
+		write_reg(base_addr, veu->start_vestr, VESTR);
+	}
 }
 
 int
@@ -702,34 +1901,64 @@ shveu_wait(SHVEU *veu)
 	uint32_t vstar;
 	int complete = 0;
 
-	uiomux_sleep(veu->uiomux, veu->uiores);
+	if (veu->cpu_op) {
+		copy_surface_stats(veu, &veu->dst_user, &veu->src_user,
+			veu->stats_surface);
+		process_alpha(veu);
+		veu->cpu_op = 0;
+		if (finish_alpha(veu) < 0)
+			return -1;
+		return 1;
+	}
+
+	process_alpha(veu);
+
+	if (veu->client_fd >= 0) {
+		if (client_wait(veu) < 0)
+			goto fail;
+		vevtr = 1;
+	} else if (veu->timeout_ms) {
+		if (wait_timeout(veu, &vevtr) < 0)
+			goto fail;
+	} else {
+		uiomux_sleep(veu->uiomux, veu->uiores);
 
-	vevtr = read_reg(base_addr, VEVTR);
-	write_reg(base_addr, 0, VEVTR);   /* ack interrupts */
+		vevtr = read_reg(base_addr, VEVTR);
+		write_reg(base_addr, 0, VEVTR);   /* ack interrupts */
+	}
 
 	/* End of VEU operation? */
 	if (vevtr & 1) {
 		dbg(__func__, __LINE__, "src_hw", &veu->src_hw);
 		dbg(__func__, __LINE__, "dst_hw", &veu->dst_hw);
-		copy_surface(&veu->dst_user, &veu->dst_hw);
+		copy_surface_stats(veu, &veu->dst_user, &veu->dst_hw, SHVEU_STATS_DST);
+		complete = 1;
+		if (finish_alpha(veu) < 0)
+			complete = -1;
 
 		/* free locally allocated surfaces */
-		if (veu->src_hw.py != veu->src_user.py) {
-			size_t len = size_y(veu->src_hw.format, veu->src_hw.h * veu->src_hw.w);
-			len += size_c(veu->src_hw.format, veu->src_hw.h * veu->src_hw.w);
-			uiomux_free(veu->uiomux, veu->uiores, veu->src_hw.py, len);
-		}
-		if (veu->dst_hw.py != veu->dst_user.py) {
-			size_t len = size_y(veu->dst_hw.format, veu->dst_hw.h * veu->dst_hw.w);
-			len += size_c(veu->dst_hw.format, veu->dst_hw.h * veu->dst_hw.w);
-			uiomux_free(veu->uiomux, veu->uiores, veu->dst_hw.py, len);
-		}
+		free_hw_surface(veu, &veu->src_hw, &veu->src_user);
+		free_hw_surface(veu, &veu->dst_hw, &veu->dst_user);
 
-		uiomux_unlock(veu->uiomux, veu->uiores);
-		complete = 1;
+		if (!veu->hold_lock && veu->client_fd < 0)
+			uiomux_unlock(veu->uiomux, veu->uiores);
 	}
 
 	return complete;
+
+fail:
+	/* The output is left as the VEU left it */
+	free(veu->alpha_tmp);
+	veu->alpha_tmp = NULL;
+	veu->alpha_op = ALPHA_NONE;
+	veu->alpha_failed = 0;
+	free_hw_surface(veu, &veu->src_hw, &veu->src_user);
+	free_hw_surface(veu, &veu->dst_hw, &veu->dst_user);
+
+	if (!veu->hold_lock && veu->client_fd < 0)
+		uiomux_unlock(veu->uiomux, veu->uiores);
+
+	return -1;
 }
 
 int
@@ -744,27 +1973,1888 @@ shveu_resize(
 
 	if (ret == 0) {
 		shveu_start(veu);
-		shveu_wait(veu);
+		if (shveu_wait(veu) < 0)
+			ret = -1;
 	}
 
 	return ret;
 }
 
 int
-shveu_rotate(
+shveu_resize_view(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	struct ren_vid_surface *dst_surface)
+{
+	if (src_surface && dst_surface
+	    && src_surface->format == dst_surface->format
+	    && src_surface->w == dst_surface->w
+	    && src_surface->h == dst_surface->h) {
+		dst_surface->pitch = src_surface->pitch;
+		dst_surface->py = src_surface->py;
+		dst_surface->pc = src_surface->pc;
+		dst_surface->pcr = src_surface->pcr;
+		dst_surface->pa = src_surface->pa;
+		return 0;
+	}
+
+	return shveu_resize(veu, src_surface, dst_surface);
+}
+
+int
+shveu_blit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface)
+{
+	int ret;
+
+	ret = shveu_setup_blit(veu, src_surface, dst_surface);
+
+	if (ret == 0) {
+		shveu_start(veu);
+		if (shveu_wait(veu) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/* Hold the lock of each VEU for a sequence of operations */
+static void hold_locks(SHVEU **veus, int nr_veus)
+{
+	int i;
+
+	for (i=0; i<nr_veus; i++) {
+		if (veus[i]->client_fd < 0)
+			uiomux_lock(veus[i]->uiomux, veus[i]->uiores);
+		veus[i]->hold_lock = 1;
+	}
+}
+
+static void release_locks(SHVEU **veus, int nr_veus)
+{
+	int i;
+
+	for (i=0; i<nr_veus; i++) {
+		veus[i]->hold_lock = 0;
+		if (veus[i]->client_fd < 0)
+			uiomux_unlock(veus[i]->uiomux, veus[i]->uiores);
+	}
+}
+
+int
+shveu_setup_field(
 	SHVEU *veu,
 	const struct ren_vid_surface *src_surface,
 	const struct ren_vid_surface *dst_surface,
-	shveu_rotation_t rotate)
+	ren_vid_field_t field)
+{
+	struct ren_vid_surface src;
+
+	if (!src_surface)
+		return -1;
+
+	get_field_surface(&src, src_surface, field);
+	return shveu_setup(veu, &src, dst_surface, SHVEU_NO_ROT);
+}
+
+int
+shveu_resize_field(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	ren_vid_field_t field)
 {
 	int ret;
 
-	ret = shveu_setup(veu, src_surface, dst_surface, rotate);
+	ret = shveu_setup_field(veu, src_surface, dst_surface, field);
 
 	if (ret == 0) {
 		shveu_start(veu);
-		shveu_wait(veu);
+		if (shveu_wait(veu) < 0)
+			ret = -1;
 	}
 
 	return ret;
 }
+
+int
+shveu_bob(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_top,
+	const struct ren_vid_surface *dst_bottom)
+{
+	int ret;
+
+	if (!veu || !src_surface || !dst_top || !dst_bottom)
+		return -1;
+
+	hold_locks(&veu, 1);
+	ret = shveu_resize_field(veu, src_surface, dst_top, REN_FIELD_TOP);
+	if (ret == 0)
+		ret = shveu_resize_field(veu, src_surface, dst_bottom, REN_FIELD_BOTTOM);
+	release_locks(&veu, 1);
+
+	return ret;
+}
+
+static int surface_area(const struct ren_vid_surface *s)
+{
+	return s->w * s->h;
+}
+
+/* Pick the smallest completed output that a smaller output can be derived
+ * from, reading fewer bytes than the source. Only outputs in the same
+ * format as the source are used, so there is no extra loss. */
+static const struct ren_vid_surface *
+derive_from(
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst,
+	int nr_dst,
+	const int *done,
+	int job)
+{
+	const struct ren_vid_surface *best = src;
+	const struct ren_vid_surface *out = &dst[job];
+	int i;
+
+	for (i=0; i<nr_dst; i++) {
+		const struct ren_vid_surface *cand = &dst[i];
+
+		if (!done[i] || i == job || cand->format != src->format)
+			continue;
+		if (cand->w < out->w || cand->h < out->h)
+			continue;
+		/* Stay within the 1/16 downscale limit */
+		if (cand->w > out->w * 16 || cand->h > out->h * 16)
+			continue;
+		if (!hw_accessible(cand))
+			continue;
+		if (surface_area(cand) < surface_area(best))
+			best = cand;
+	}
+
+	return best;
+}
+
+int
+shveu_resize_multi(
+	SHVEU **veus,
+	int nr_veus,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surfaces,
+	int nr_dst)
+{
+	const struct veu_format_info *info;
+	struct ren_vid_surface src;
+	int *order = NULL;
+	int *done = NULL;
+	int busy[SHVEU_UIO_VEU_MAX];
+	int started[SHVEU_UIO_VEU_MAX];
+	int seq = 0;
+	int nr_done = 0;
+	int next = 0;
+	int ret = 0;
+	int i, j;
+
+	if (!veus || nr_veus < 1 || !src_surface || !dst_surfaces || nr_dst < 1)
+		return -1;
+	if (nr_veus > SHVEU_UIO_VEU_MAX)
+		nr_veus = SHVEU_UIO_VEU_MAX;
+
+	info = fmt_info(src_surface->format);
+	if (!info)
+		return -1;
+
+	order = calloc(nr_dst, sizeof(*order));
+	done = calloc(nr_dst, sizeof(*done));
+	if (!order || !done) {
+		ret = -1;
+		goto out;
+	}
+
+	/* Largest outputs first, so that smaller ones can be derived from them */
+	for (i=0; i<nr_dst; i++) {
+		for (j=i; j>0 && surface_area(&dst_surfaces[order[j-1]]) < surface_area(&dst_surfaces[i]); j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+
+	/* Copy the source to a buffer the hardware can access just once */
+	if (get_hw_surface(veus[0]->uiomux, veus[0]->uiores, &src, src_surface, info->hw_fmt) < 0) {
+		ret = -1;
+		goto out;
+	}
+	copy_surface(&src, src_surface);
+
+	hold_locks(veus, nr_veus);
+
+	for (i=0; i<nr_veus; i++)
+		busy[i] = -1;
+
+	while (nr_done < nr_dst) {
+		int oldest = -1;
+
+		/* Start the next outputs on idle VEUs */
+		for (i=0; i<nr_veus && next < nr_dst; i++) {
+			const struct ren_vid_surface *in;
+			int job = order[next];
+
+			if (busy[i] >= 0)
+				continue;
+
+			next++;
+			in = derive_from(&src, dst_surfaces, nr_dst, done, job);
+			if (veu_setup(veus[i], in, &dst_surfaces[job], SHVEU_NO_ROT, 1) < 0) {
+				ret = -1;
+				done[job] = 1;
+				nr_done++;
+				continue;
+			}
+			shveu_start(veus[i]);
+			busy[i] = job;
+			started[i] = seq++;
+		}
+
+		/* Wait for the output that was started first */
+		for (i=0; i<nr_veus; i++) {
+			if (busy[i] >= 0 && (oldest < 0 || started[i] < started[oldest]))
+				oldest = i;
+		}
+		if (oldest < 0)
+			continue;
+
+		if (shveu_wait(veus[oldest]) < 0)
+			ret = -1;
+		done[busy[oldest]] = 1;
+		busy[oldest] = -1;
+		nr_done++;
+	}
+
+	release_locks(veus, nr_veus);
+
+	free_hw_surface(veus[0], &src, src_surface);
+
+out:
+	free(order);
+	free(done);
+	return ret;
+}
+
+static int rects_overlap(const struct ren_vid_rect *a, const struct ren_vid_rect *b)
+{
+	return a->x < b->x + b->w && b->x < a->x + a->w
+	    && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+/* The part of a surface that get_sel_surface() selects for a rect */
+static void aligned_rect(
+	struct ren_vid_rect *out,
+	const struct ren_vid_surface *s,
+	const struct ren_vid_rect *sel)
+{
+	out->x = sel->x & ~(horz_increment(s->format) - 1);
+	out->y = sel->y & ~(vert_increment(s->format) - 1);
+	out->w = sel->w & ~(horz_increment(s->format) - 1);
+	out->h = sel->h & ~(vert_increment(s->format) - 1);
+}
+
+static int rect_inside(const struct ren_vid_rect *r, const struct ren_vid_surface *s)
+{
+	return r->x >= 0 && r->y >= 0 && r->w > 0 && r->h > 0
+	    && r->w <= s->w - r->x && r->h <= s->h - r->y;
+}
+
+/* A layer can start once all layers below it that it covers are done */
+static int layer_ready(
+	const struct ren_vid_rect *rects,
+	const int *order,
+	const int *done,
+	int pos)
+{
+	int i;
+
+	for (i=0; i<pos; i++) {
+		if (!done[order[i]]
+		    && rects_overlap(&rects[order[i]], &rects[order[pos]]))
+			return 0;
+	}
+	return 1;
+}
+
+int
+shveu_compose(
+	SHVEU **veus,
+	int nr_veus,
+	const struct ren_vid_surface *dst_surface,
+	const struct shveu_layer *layers,
+	int nr_layers)
+{
+	struct ren_vid_rect *rects = NULL;
+	int *order = NULL;
+	int *done = NULL;
+	int *started_job = NULL;
+	int busy[SHVEU_UIO_VEU_MAX];
+	int started[SHVEU_UIO_VEU_MAX];
+	int seq = 0;
+	int nr_done = 0;
+	int ret = 0;
+	int i, j;
+
+	if (!veus || nr_veus < 1 || !dst_surface || !layers || nr_layers < 1)
+		return -1;
+	if (nr_veus > SHVEU_UIO_VEU_MAX)
+		nr_veus = SHVEU_UIO_VEU_MAX;
+
+	rects = calloc(nr_layers, sizeof(*rects));
+	order = calloc(nr_layers, sizeof(*order));
+	done = calloc(nr_layers, sizeof(*done));
+	started_job = calloc(nr_layers, sizeof(*started_job));
+	if (!rects || !order || !done || !started_job) {
+		ret = -1;
+		goto out;
+	}
+
+	/* The VEU writes the aligned rects, which must lie within the output */
+	for (i=0; i<nr_layers; i++) {
+		if (!rect_inside(&layers[i].dst_rect, dst_surface)) {
+			debug_info("ERR: layer is outside the output");
+			ret = -1;
+			goto out;
+		}
+		aligned_rect(&rects[i], dst_surface, &layers[i].dst_rect);
+	}
+
+	/* Bottom layer first, layers with the same z in the given order */
+	for (i=0; i<nr_layers; i++) {
+		for (j=i; j>0 && layers[order[j-1]].z > layers[i].z; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+
+	hold_locks(veus, nr_veus);
+
+	for (i=0; i<nr_veus; i++)
+		busy[i] = -1;
+
+	while (nr_done < nr_layers) {
+		int oldest = -1;
+		int pos = 0;
+
+		/* Start the lowest layers that are ready on idle VEUs */
+		for (i=0; i<nr_veus; i++) {
+			struct ren_vid_surface dst;
+			int job = -1;
+
+			if (busy[i] >= 0)
+				continue;
+
+			for (; pos<nr_layers; pos++) {
+				if (!started_job[order[pos]] && layer_ready(rects, order, done, pos)) {
+					job = order[pos++];
+					break;
+				}
+			}
+			if (job < 0)
+				break;
+
+			started_job[job] = 1;
+			get_sel_surface(&dst, dst_surface, &rects[job]);
+			if (!layers[job].src
+			    || veu_setup(veus[i], layers[job].src, &dst, SHVEU_NO_ROT, 1) < 0) {
+				ret = -1;
+				done[job] = 1;
+				nr_done++;
+				i--;	/* try the next layer on this VEU */
+				continue;
+			}
+			shveu_start(veus[i]);
+			busy[i] = job;
+			started[i] = seq++;
+		}
+
+		/* Wait for the layer that was started first */
+		for (i=0; i<nr_veus; i++) {
+			if (busy[i] >= 0 && (oldest < 0 || started[i] < started[oldest]))
+				oldest = i;
+		}
+		if (oldest < 0)
+			continue;
+
+		if (shveu_wait(veus[oldest]) < 0)
+			ret = -1;
+		done[busy[oldest]] = 1;
+		busy[oldest] = -1;
+		nr_done++;
+	}
+
+	release_locks(veus, nr_veus);
+
+out:
+	free(rects);
+	free(order);
+	free(done);
+	free(started_job);
+	return ret;
+}
+
+/* Offset of each plane in a multi-surface buffer */
+#define PLANE_ALIGN 32
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct shveu_pyramid *
+shveu_pyramid_new(
+	SHVEU *veu,
+	ren_vid_format_t format,
+	int w,
+	int h,
+	int nr_levels)
+{
+	const struct veu_format_info *info = fmt_info(format);
+	struct shveu_pyramid *pyr;
+	size_t offset = 0;
+	int i;
+
+	if (!veu || !info || nr_levels < 1)
+		return NULL;
+	if (nr_levels > SHVEU_PYRAMID_MAX_LEVELS)
+		nr_levels = SHVEU_PYRAMID_MAX_LEVELS;
+
+	pyr = calloc(1, sizeof(*pyr));
+	if (!pyr)
+		return NULL;
+
+	format = info->hw_fmt;
+
+	/* Work out the layout, then allocate it in one go */
+	for (i=0; i<nr_levels; i++) {
+		struct ren_vid_surface *s = &pyr->level[i];
+
+		s->format = format;
+		s->w = (w >> (i+1)) & ~(horz_increment(format) - 1);
+		s->h = (h >> (i+1)) & ~(vert_increment(format) - 1);
+		s->pitch = s->w;
+		if (s->w < 2 || s->h < 2)
+			break;
+
+		s->py = (void *)offset;
+		offset = ALIGN_UP(offset + size_y(format, s->w * s->h), PLANE_ALIGN);
+		if (fmts[format].c_bpp) {
+			s->pc = (void *)offset;
+			offset = ALIGN_UP(offset + size_c(format, s->w * s->h), PLANE_ALIGN);
+		}
+	}
+	pyr->nr_levels = i;
+
+	if (pyr->nr_levels == 0)
+		goto err;
+
+	pyr->size = offset;
+	pyr->mem = uiomux_malloc(veu->uiomux, veu->uiores, pyr->size, PLANE_ALIGN);
+	if (!pyr->mem)
+		goto err;
+
+	for (i=0; i<pyr->nr_levels; i++) {
+		struct ren_vid_surface *s = &pyr->level[i];
+
+		s->py = pyr->mem + (size_t)s->py;
+		if (fmts[format].c_bpp)
+			s->pc = pyr->mem + (size_t)s->pc;
+	}
+
+	return pyr;
+
+err:
+	free(pyr);
+	return NULL;
+}
+
+void
+shveu_pyramid_free(
+	SHVEU *veu,
+	struct shveu_pyramid *pyr)
+{
+	if (!pyr)
+		return;
+	if (veu && pyr->mem)
+		uiomux_free(veu->uiomux, veu->uiores, pyr->mem, pyr->size);
+	free(pyr);
+}
+
+int
+shveu_pyramid_run(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	struct shveu_pyramid *pyr)
+{
+	const struct ren_vid_surface *in = src_surface;
+	int ret = 0;
+	int i;
+
+	if (!veu || !src_surface || !pyr)
+		return -1;
+
+	hold_locks(&veu, 1);
+
+	for (i=0; i<pyr->nr_levels; i++) {
+		ret = veu_setup(veu, in, &pyr->level[i], SHVEU_NO_ROT, 1);
+		if (ret < 0)
+			break;
+		shveu_start(veu);
+		if (shveu_wait(veu) < 0) {
+			ret = -1;
+			break;
+		}
+		in = &pyr->level[i];
+	}
+
+	release_locks(&veu, 1);
+
+	return ret;
+}
+
+/* Can the next ROI reuse the register state of the last operation? Only the
+ * addresses, sizes, clipping and scale are rewritten. */
+static int roi_reusable(
+	SHVEU *veu,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	/* Alpha is handled per operation in setup_alpha() */
+	return !veu->cpu_op
+	    && veu->client_fd < 0
+	    && src->format != REN_ARGB32 && !src->pa
+	    && dst->format != REN_ARGB32 && !dst->pa
+	    && veu->filter_control == SHVEU_NO_ROT
+	    && src->format == veu->src_hw.format
+	    && dst->format == veu->dst_user.format
+	    && dst->format == veu->dst_hw.format
+	    && src->format != REN_Y8
+	    && dst->format != REN_Y8
+	    && hw_accessible(dst)
+	    && scale_supported(veu, (float)dst->w / src->w, (float)dst->h / src->h);
+}
+
+static void update_roi(
+	SHVEU *veu,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	void *base_addr = veu->uio_mmio.iomem;
+
+	veu->src_user = veu->src_hw = *src;
+	veu->dst_user = veu->dst_hw = *dst;
+
+	write_reg(base_addr, 0, VEVTR);
+
+	write_reg(base_addr, uiomux_all_virt_to_phys(src->py), VSAYR);
+	write_reg(base_addr, uiomux_all_virt_to_phys(src->pc), VSACR);
+	write_reg(base_addr, (src->h << 16) | src->w, VESSR);
+	write_reg(base_addr, size_y(src->format, src->pitch), VESWR);
+
+	write_reg(base_addr, uiomux_all_virt_to_phys(dst->py), VDAYR);
+	write_reg(base_addr, uiomux_all_virt_to_phys(dst->pc), VDACR);
+	write_reg(base_addr, size_y(dst->format, dst->pitch), VEDWR);
+
+	set_clip(base_addr, 0, dst->w);
+	set_clip(base_addr, 1, dst->h);
+
+	set_scale(veu, base_addr, 0, src->w, dst->w, 0);
+	set_scale(veu, base_addr, 1, src->h, dst->h, 0);
+}
+
+int
+shveu_resize_rois(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_rect *rois,
+	int nr_rois,
+	const struct ren_vid_surface *dst_surfaces)
+{
+	const struct veu_format_info *info;
+	struct ren_vid_surface src;
+	int programmed = 0;
+	int ret = 0;
+	int i;
+
+	if (!veu || !src_surface || !rois || nr_rois < 1 || !dst_surfaces)
+		return -1;
+
+	info = fmt_info(src_surface->format);
+	if (!info)
+		return -1;
+
+	/* Copy the source to a buffer the hardware can access just once */
+	if (get_hw_surface(veu->uiomux, veu->uiores, &src, src_surface, info->hw_fmt) < 0)
+		return -1;
+	copy_surface(&src, src_surface);
+
+	hold_locks(&veu, 1);
+
+	for (i=0; i<nr_rois; i++) {
+		struct ren_vid_surface in;
+
+		get_sel_surface(&in, &src, &rois[i]);
+
+		if (programmed && roi_reusable(veu, &in, &dst_surfaces[i])) {
+			update_roi(veu, &in, &dst_surfaces[i]);
+		} else if (veu_setup(veu, &in, &dst_surfaces[i], SHVEU_NO_ROT, 0) < 0) {
+			programmed = 0;
+			ret = -1;
+			continue;
+		}
+		programmed = 1;
+		shveu_start(veu);
+		if (shveu_wait(veu) < 0) {
+			/* The VEU was reset, so it must be set up again */
+			programmed = 0;
+			ret = -1;
+		}
+	}
+
+	release_locks(&veu, 1);
+
+	free_hw_surface(veu, &src, src_surface);
+
+	return ret;
+}
+
+/* Round a span out to a multiple of inc, limited to [0, max) */
+static void align_span(int *start, int *end, int inc, int max)
+{
+	*start = (*start / inc) * inc;
+	*end = ((*end + inc - 1) / inc) * inc;
+	if (*start < 0)
+		*start = 0;
+	if (*end > max)
+		*end = max;
+}
+
+/* Map a damaged input rectangle to the output rectangle it affects, padded
+ * by the filter footprint and aligned to the chroma sampling */
+static void damage_to_dst(
+	struct ren_vid_rect *out,
+	const struct ren_vid_rect *in,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	int pad_x = (dst->w + src->w - 1) / src->w + 1;
+	int pad_y = (dst->h + src->h - 1) / src->h + 1;
+	int x0 = (in->x * dst->w) / src->w - pad_x;
+	int y0 = (in->y * dst->h) / src->h - pad_y;
+	int x1 = ((in->x + in->w) * dst->w + src->w - 1) / src->w + pad_x;
+	int y1 = ((in->y + in->h) * dst->h + src->h - 1) / src->h + pad_y;
+
+	align_span(&x0, &x1, horz_increment(dst->format), dst->w);
+	align_span(&y0, &y1, vert_increment(dst->format), dst->h);
+
+	out->x = x0;
+	out->y = y0;
+	out->w = x1 - x0;
+	out->h = y1 - y0;
+}
+
+/* Map an output rectangle back to the input rectangle that produces it */
+static void dst_to_src(
+	struct ren_vid_rect *out,
+	const struct ren_vid_rect *in,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst)
+{
+	int x0 = (in->x * src->w) / dst->w;
+	int y0 = (in->y * src->h) / dst->h;
+	int x1 = ((in->x + in->w) * src->w + dst->w - 1) / dst->w;
+	int y1 = ((in->y + in->h) * src->h + dst->h - 1) / dst->h;
+
+	align_span(&x0, &x1, horz_increment(src->format), src->w);
+	align_span(&y0, &y1, vert_increment(src->format), src->h);
+
+	out->x = x0;
+	out->y = y0;
+	out->w = x1 - x0;
+	out->h = y1 - y0;
+}
+
+static int rects_touch(const struct ren_vid_rect *a, const struct ren_vid_rect *b)
+{
+	return a->x <= b->x + b->w && b->x <= a->x + a->w
+	    && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void merge_rect(struct ren_vid_rect *a, const struct ren_vid_rect *b)
+{
+	int x1 = a->x + a->w;
+	int y1 = a->y + a->h;
+
+	if (b->x + b->w > x1)
+		x1 = b->x + b->w;
+	if (b->y + b->h > y1)
+		y1 = b->y + b->h;
+	if (b->x < a->x)
+		a->x = b->x;
+	if (b->y < a->y)
+		a->y = b->y;
+	a->w = x1 - a->x;
+	a->h = y1 - a->y;
+}
+
+/* Merge overlapping or adjacent rectangles in place, returns the new count */
+static int merge_rects(struct ren_vid_rect *rects, int nr)
+{
+	int merged = 1;
+	int i, j;
+
+	while (merged) {
+		merged = 0;
+		for (i=0; i<nr; i++) {
+			for (j=i+1; j<nr; j++) {
+				if (rects_touch(&rects[i], &rects[j])) {
+					merge_rect(&rects[i], &rects[j]);
+					rects[j] = rects[--nr];
+					merged = 1;
+					j--;
+				}
+			}
+		}
+	}
+
+	return nr;
+}
+
+int
+shveu_resize_damage(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *damage,
+	int nr_damage)
+{
+	const struct veu_format_info *info;
+	struct ren_vid_rect *rects;
+	struct ren_vid_rect *src_rects = NULL;
+	struct ren_vid_surface *dsts = NULL;
+	int area = 0;
+	int ret = 0;
+	int nr = 0;
+	int i;
+
+	if (!veu || !src_surface || !dst_surface || (nr_damage > 0 && !damage))
+		return -1;
+
+	info = fmt_info(src_surface->format);
+	if (!info || !fmt_info(dst_surface->format))
+		return -1;
+
+	if (nr_damage < 1)
+		return 0;
+
+	rects = calloc(nr_damage, sizeof(*rects));
+	if (!rects)
+		return -1;
+
+	for (i=0; i<nr_damage; i++) {
+		if (damage[i].w <= 0 || damage[i].h <= 0)
+			continue;
+		damage_to_dst(&rects[nr], &damage[i], src_surface, dst_surface);
+		if (rects[nr].w > 0 && rects[nr].h > 0)
+			nr++;
+	}
+	nr = merge_rects(rects, nr);
+
+	for (i=0; i<nr; i++)
+		area += rects[i].w * rects[i].h;
+
+	/* Most of the surface changed, so convert all of it in one go */
+	if (area * 2 > dst_surface->w * dst_surface->h) {
+		free(rects);
+		return shveu_resize(veu, src_surface, dst_surface);
+	}
+
+	src_rects = calloc(nr, sizeof(*src_rects));
+	dsts = calloc(nr, sizeof(*dsts));
+	if (nr && (!src_rects || !dsts)) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i=0; i<nr; i++) {
+		dst_to_src(&src_rects[i], &rects[i], src_surface, dst_surface);
+		get_sel_surface(&dsts[i], dst_surface, &rects[i]);
+	}
+
+	if (nr == 0) {
+		/* Nothing to do */
+	} else if (src_surface->format == info->hw_fmt && hw_accessible(src_surface)) {
+		ret = shveu_resize_rois(veu, src_surface, src_rects, nr, dsts);
+	} else {
+		/* Only copy the damaged parts of the input */
+		hold_locks(&veu, 1);
+		for (i=0; i<nr; i++) {
+			struct ren_vid_surface in;
+
+			get_sel_surface(&in, src_surface, &src_rects[i]);
+			if (shveu_resize(veu, &in, &dsts[i]) < 0)
+				ret = -1;
+		}
+		release_locks(&veu, 1);
+	}
+
+out:
+	free(src_rects);
+	free(dsts);
+	free(rects);
+	return ret;
+}
+
+/* Maximum VEU input size, as per the VEU2H */
+#define VEU_MAX_W 2560
+#define VEU_MAX_H 1920
+
+int
+shveu_batch_atlas_height(
+	int nr,
+	int atlas_w,
+	int dst_w,
+	int dst_h)
+{
+	int cols;
+
+	if (nr < 1 || dst_w < 1 || dst_h < 1)
+		return -1;
+
+	cols = atlas_w / dst_w;
+	if (cols < 1)
+		return -1;
+
+	return ((nr + cols - 1) / cols) * dst_h;
+}
+
+/* Is a drift in input pixels within half an output pixel */
+static int drift_ok(double drift, double step)
+{
+	if (drift < 0)
+		drift = -drift;
+	return drift < 0.5 * step;
+}
+
+/* Largest number of tiles, up to max, that can be scaled together along
+ * one axis. A block of n tiles is scaled with the step for the whole block,
+ * so the sampling of each tile drifts from scaling it on its own, in
+ * proportion to its position in the block and in the tile. Keep the drift
+ * under half an output pixel. */
+static int batch_tiles(SHVEU *veu, int size_in, int size_out, int max)
+{
+	double tile_step = scale_step(veu, size_in, size_out) / 4096.0;
+	int n;
+
+	for (n=max; n>1; n--) {
+		double step = scale_step(veu, n * size_in, n * size_out) / 4096.0;
+		int k = n - 1;
+		int j = size_out - 1;
+		double last_start = k * size_out * step - k * size_in;
+		double last_end = (k * size_out + j) * step - (k * size_in + j * tile_step);
+		double first_end = j * (step - tile_step);
+
+		/* The drift is linear, so it is largest at a corner */
+		if (drift_ok(last_start, tile_step)
+		    && drift_ok(last_end, tile_step)
+		    && drift_ok(first_end, tile_step))
+			break;
+	}
+
+	return n;
+}
+
+/* Get a tile of an atlas */
+static void get_tile(
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *atlas,
+	int col, int row, int w, int h)
+{
+	struct ren_vid_rect sel;
+
+	sel.x = col * w;
+	sel.y = row * h;
+	sel.w = w;
+	sel.h = h;
+	get_sel_surface(out, atlas, &sel);
+}
+
+int
+shveu_resize_batch(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surfaces,
+	int nr_src,
+	const struct ren_vid_surface *dst_atlas,
+	int dst_w,
+	int dst_h,
+	struct ren_vid_surface *dst_surfaces)
+{
+	const struct veu_format_info *info;
+	const struct ren_vid_surface *s0 = src_surfaces;
+	struct ren_vid_surface atlas;
+	int cols, rows, pass_cols, pass_rows;
+	int row0, col0;
+	int ret = 0;
+	int i;
+
+	if (!veu || !src_surfaces || nr_src < 1 || !dst_atlas || !dst_surfaces)
+		return -1;
+
+	info = fmt_info(s0->format);
+	if (!info || !fmt_info(dst_atlas->format))
+		return -1;
+
+	for (i=1; i<nr_src; i++) {
+		if (src_surfaces[i].format != s0->format
+		    || src_surfaces[i].w != s0->w || src_surfaces[i].h != s0->h) {
+			debug_info("ERR: Batch inputs differ in format or size");
+			return -1;
+		}
+	}
+
+	/* Tiles must start on a chroma sample */
+	if ((s0->w % horz_increment(info->hw_fmt)) || (s0->h % vert_increment(info->hw_fmt))
+	    || (dst_w % horz_increment(dst_atlas->format)) || (dst_h % vert_increment(dst_atlas->format))) {
+		debug_info("ERR: Batch surface sizes are not aligned");
+		return -1;
+	}
+
+	/* The output atlas layout, as per shveu_batch_atlas_height() */
+	rows = shveu_batch_atlas_height(nr_src, dst_atlas->w, dst_w, dst_h);
+	if (rows < 0 || rows > dst_atlas->h) {
+		debug_info("ERR: Output atlas is too small");
+		return -1;
+	}
+	cols = dst_atlas->w / dst_w;
+	rows /= dst_h;
+
+	/* Each pass scales a block of tiles that fits in the VEU */
+	pass_cols = VEU_MAX_W / s0->w;
+	pass_rows = VEU_MAX_H / s0->h;
+	if (pass_cols < 1 || pass_rows < 1)
+		return -1;
+	if (pass_cols > cols)
+		pass_cols = cols;
+	if (pass_cols > nr_src)
+		pass_cols = nr_src;
+	if (pass_rows > rows)
+		pass_rows = rows;
+	pass_cols = batch_tiles(veu, s0->w, dst_w, pass_cols);
+	pass_rows = batch_tiles(veu, s0->h, dst_h, pass_rows);
+
+	/* Input atlas, reused for each pass */
+	atlas.format = info->hw_fmt;
+	atlas.w = pass_cols * s0->w;
+	atlas.h = pass_rows * s0->h;
+	atlas.pitch = atlas.w;
+	atlas.pa = NULL;
+	atlas.pcr = NULL;
+	atlas.py = uiomux_malloc(veu->uiomux, veu->uiores, hw_surface_size(&atlas), 32);
+	if (!atlas.py)
+		return -1;
+	atlas.pc = NULL;
+	if (fmts[atlas.format].c_bpp)
+		atlas.pc = atlas.py + size_y(atlas.format, atlas.w * atlas.h);
+
+	hold_locks(&veu, 1);
+
+	for (row0=0; row0<rows && ret==0; row0 += pass_rows) {
+		for (col0=0; col0<cols; col0 += pass_cols) {
+			struct ren_vid_surface in, out;
+			struct ren_vid_rect sel;
+			int w = pass_cols;
+			int h = pass_rows;
+			int r, c;
+
+			if (row0 * cols + col0 >= nr_src)
+				break;
+			if (w > cols - col0)
+				w = cols - col0;
+			if (h > rows - row0)
+				h = rows - row0;
+			/* Trim a block that only covers the last row */
+			if (h == 1 && w > nr_src - row0 * cols - col0)
+				w = nr_src - row0 * cols - col0;
+
+			/* Pack the inputs, missing tiles in the last row are not set */
+			for (r=0; r<h; r++) {
+				for (c=0; c<w; c++) {
+					struct ren_vid_surface tile;
+
+					i = (row0 + r) * cols + col0 + c;
+					if (i >= nr_src)
+						break;
+					get_tile(&tile, &atlas, c, r, s0->w, s0->h);
+					copy_surface(&tile, &src_surfaces[i]);
+				}
+			}
+
+			sel.x = 0;
+			sel.y = 0;
+			sel.w = w * s0->w;
+			sel.h = h * s0->h;
+			get_sel_surface(&in, &atlas, &sel);
+
+			sel.x = col0 * dst_w;
+			sel.y = row0 * dst_h;
+			sel.w = w * dst_w;
+			sel.h = h * dst_h;
+			get_sel_surface(&out, dst_atlas, &sel);
+
+			if (veu_setup(veu, &in, &out, SHVEU_NO_ROT, 1) < 0) {
+				ret = -1;
+				break;
+			}
+			shveu_start(veu);
+			if (shveu_wait(veu) < 0) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	release_locks(&veu, 1);
+
+	uiomux_free(veu->uiomux, veu->uiores, atlas.py, hw_surface_size(&atlas));
+
+	if (ret == 0) {
+		for (i=0; i<nr_src; i++)
+			get_tile(&dst_surfaces[i], dst_atlas, i % cols, i / cols, dst_w, dst_h);
+	}
+
+	return ret;
+}
+
+int
+shveu_rotate(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t rotate)
+{
+	int ret;
+
+	ret = shveu_setup(veu, src_surface, dst_surface, rotate);
+
+	if (ret == 0) {
+		shveu_start(veu);
+		if (shveu_wait(veu) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/* Rows hashed per row read when the cache samples the input */
+#define CACHE_SAMPLE_STEP 8
+
+struct cache_entry {
+	struct cache_entry *next;
+	uint64_t hash;
+	ren_vid_format_t src_format;
+	int src_w;
+	int src_h;
+	int filter_control;
+	int bt709;
+	int full_range;
+	struct ren_vid_surface dst;	/* cached output, pitch is the width */
+	size_t size;
+	unsigned long last_used;
+};
+
+struct shveu_cache {
+	struct cache_entry *entries;
+	int sampled;
+	unsigned long tick;
+	struct shveu_cache_stats stats;
+};
+
+static uint64_t hash_plane(uint64_t h, const void *p, int len, int rows, int pitch, int step)
+{
+	int y;
+
+	if (!p)
+		return h;
+
+	for (y=0; y<rows; y+=step)
+		h = veu_hash(h, p + y * pitch, len);
+
+	/* Always include the last row */
+	if (step > 1 && rows > 0 && (rows - 1) % step)
+		h = veu_hash(h, p + (rows - 1) * pitch, len);
+
+	return h;
+}
+
+static uint64_t hash_surface(const struct ren_vid_surface *s, int step)
+{
+	const struct format_info *fmt = &fmts[s->format];
+	int c_len = fmt->c_bpp * s->w / fmt->c_ss_horz;
+	int c_rows = s->h / fmt->c_ss_vert;
+	uint64_t h = 0;
+
+	h = hash_plane(h, s->py, size_y(s->format, s->w), s->h, size_y(s->format, s->pitch), step);
+	if (fmt->c_bpp) {
+		h = hash_plane(h, s->pc, c_len, c_rows, c_pitch(s), step);
+		if (is_planar(s->format))
+			h = hash_plane(h, s->pcr, c_len, c_rows, c_pitch(s), step);
+	}
+	h = hash_plane(h, s->pa, s->w, s->h, s->pitch, step);
+
+	return h;
+}
+
+static size_t cache_entry_size(const struct ren_vid_surface *s)
+{
+	size_t size = size_y(s->format, s->w * s->h) + size_c(s->format, s->w * s->h);
+
+	if (s->pa)
+		size += size_a(s->format, s->w * s->h);
+	return size;
+}
+
+static int cache_match(
+	SHVEU *veu,
+	const struct cache_entry *e,
+	uint64_t hash,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst,
+	int filter_control)
+{
+	return e->hash == hash
+	    && e->src_format == src->format && e->src_w == src->w && e->src_h == src->h
+	    && e->dst.format == dst->format && e->dst.w == dst->w && e->dst.h == dst->h
+	    && !e->dst.pa == !dst->pa
+	    && e->filter_control == filter_control
+	    && e->bt709 == veu->bt709 && e->full_range == veu->full_range;
+}
+
+static void cache_remove(struct shveu_cache *cache, struct cache_entry *e)
+{
+	struct cache_entry **pp;
+
+	for (pp = &cache->entries; *pp; pp = &(*pp)->next) {
+		if (*pp == e) {
+			*pp = e->next;
+			break;
+		}
+	}
+	cache->stats.used -= e->size;
+	cache->stats.entries--;
+	free(e);
+}
+
+/* Free least recently used entries until size bytes fit in the budget */
+static void cache_evict(struct shveu_cache *cache, size_t size)
+{
+	while (cache->entries && cache->stats.used + size > cache->stats.budget) {
+		struct cache_entry *e, *lru = cache->entries;
+
+		for (e = cache->entries; e; e = e->next) {
+			if (e->last_used < lru->last_used)
+				lru = e;
+		}
+		cache_remove(cache, lru);
+		cache->stats.evictions++;
+	}
+}
+
+static void cache_insert(
+	SHVEU *veu,
+	struct shveu_cache *cache,
+	uint64_t hash,
+	const struct ren_vid_surface *src,
+	const struct ren_vid_surface *dst,
+	int filter_control)
+{
+	size_t size = cache_entry_size(dst);
+	struct cache_entry *e;
+	void *buf;
+
+	if (size > cache->stats.budget)
+		return;
+	cache_evict(cache, size);
+
+	e = calloc(1, sizeof(*e) + size);
+	if (!e)
+		return;
+	buf = e + 1;
+
+	e->hash = hash;
+	e->src_format = src->format;
+	e->src_w = src->w;
+	e->src_h = src->h;
+	e->filter_control = filter_control;
+	e->bt709 = veu->bt709;
+	e->full_range = veu->full_range;
+	e->size = size;
+	e->last_used = cache->tick;
+
+	e->dst.format = dst->format;
+	e->dst.w = dst->w;
+	e->dst.h = dst->h;
+	e->dst.pitch = dst->w;
+	e->dst.py = buf;
+	e->dst.pc = NULL;
+	e->dst.pcr = NULL;
+	e->dst.pa = NULL;
+	buf += size_y(dst->format, dst->w * dst->h);
+	if (fmts[dst->format].c_bpp) {
+		e->dst.pc = buf;
+		if (is_planar(dst->format))
+			e->dst.pcr = buf + size_c(dst->format, dst->w * dst->h) / 2;
+	}
+	buf += size_c(dst->format, dst->w * dst->h);
+	if (dst->pa)
+		e->dst.pa = buf;
+
+	copy_surface(&e->dst, dst);
+
+	e->next = cache->entries;
+	cache->entries = e;
+	cache->stats.used += size;
+	cache->stats.entries++;
+}
+
+struct shveu_cache *
+shveu_cache_new(
+	size_t budget,
+	int sampled)
+{
+	struct shveu_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->sampled = sampled;
+	cache->stats.budget = budget;
+
+	return cache;
+}
+
+void
+shveu_cache_free(
+	struct shveu_cache *cache)
+{
+	if (!cache)
+		return;
+
+	while (cache->entries)
+		cache_remove(cache, cache->entries);
+	free(cache);
+}
+
+void
+shveu_cache_stats(
+	struct shveu_cache *cache,
+	struct shveu_cache_stats *stats)
+{
+	if (cache && stats)
+		*stats = cache->stats;
+}
+
+int
+shveu_convert_cached(
+	SHVEU *veu,
+	struct shveu_cache *cache,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t filter_control)
+{
+	struct cache_entry *e;
+	uint64_t hash;
+	int ret;
+
+	if (!cache)
+		return shveu_rotate(veu, src_surface, dst_surface, filter_control);
+
+	if (!veu || !src_surface || !dst_surface
+	    || !fmt_info(src_surface->format) || !fmt_info(dst_surface->format))
+		return -1;
+
+	cache->tick++;
+	hash = hash_surface(src_surface, cache->sampled ? CACHE_SAMPLE_STEP : 1);
+
+	for (e = cache->entries; e; e = e->next) {
+		if (cache_match(veu, e, hash, src_surface, dst_surface, filter_control)) {
+			struct ren_vid_surface out = *dst_surface;
+
+			copy_surface(&out, &e->dst);
+			e->last_used = cache->tick;
+			cache->stats.hits++;
+			return 1;
+		}
+	}
+
+	cache->stats.misses++;
+	ret = shveu_rotate(veu, src_surface, dst_surface, filter_control);
+	if (ret == 0)
+		cache_insert(veu, cache, hash, src_surface, dst_surface, filter_control);
+
+	return ret;
+}
+
+static uint8_t clamp_u8(int v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return v;
+}
+
+/* Convert a 0xAARRGGBB colour to YCbCr, with the colour settings of the VEU */
+static void argb_to_ycbcr(SHVEU *veu, uint32_t argb, uint8_t *y, uint8_t *cb, uint8_t *cr)
+{
+	int r = (argb >> 16) & 0xff;
+	int g = (argb >> 8) & 0xff;
+	int b = argb & 0xff;
+	int bt709 = veu ? veu->bt709 : 0;
+	int full_range = veu ? veu->full_range : 0;
+
+	if (!bt709 && !full_range) {
+		*y  = clamp_u8(16  + ((  66*r + 129*g +  25*b + 128) >> 8));
+		*cb = clamp_u8(128 + (( -38*r -  74*g + 112*b + 128) >> 8));
+		*cr = clamp_u8(128 + (( 112*r -  94*g -  18*b + 128) >> 8));
+	} else if (!bt709) {
+		*y  = clamp_u8(      ((  77*r + 150*g +  29*b + 128) >> 8));
+		*cb = clamp_u8(128 + (( -43*r -  85*g + 128*b + 128) >> 8));
+		*cr = clamp_u8(128 + (( 128*r - 107*g -  21*b + 128) >> 8));
+	} else if (!full_range) {
+		*y  = clamp_u8(16  + ((  47*r + 157*g +  16*b + 128) >> 8));
+		*cb = clamp_u8(128 + (( -26*r -  87*g + 112*b + 128) >> 8));
+		*cr = clamp_u8(128 + (( 112*r - 102*g -  10*b + 128) >> 8));
+	} else {
+		*y  = clamp_u8(      ((  54*r + 183*g +  18*b + 128) >> 8));
+		*cb = clamp_u8(128 + (( -29*r -  99*g + 128*b + 128) >> 8));
+		*cr = clamp_u8(128 + (( 128*r - 116*g -  12*b + 128) >> 8));
+	}
+}
+
+/* Fill rows of a plane, each of n copies of pattern */
+static void fill_plane(void *p, int pitch, int rows, const uint8_t *pattern, int size, int n)
+{
+	int y;
+
+	if (!p || rows <= 0 || n <= 0)
+		return;
+
+	veu_fill_row(p, pattern, size, n);
+	for (y=1; y<rows; y++)
+		memcpy(p + y * pitch, p, size * n);
+}
+
+int
+shveu_fill_rect(
+	SHVEU *veu,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *rect,
+	uint32_t argb)
+{
+	const struct format_info *fmt;
+	struct ren_vid_surface s;
+	struct ren_vid_rect clip;
+	uint8_t pat[4];
+	uint8_t y, cb, cr;
+	uint8_t alpha = argb >> 24;
+	int c_w, c_h;
+
+	if (!dst_surface || !rect || !fmt_info(dst_surface->format))
+		return -1;
+
+	/* Only fill the part of the rectangle within the surface */
+	clip = *rect;
+	if (clip.x < 0) {
+		clip.w += clip.x;
+		clip.x = 0;
+	}
+	if (clip.y < 0) {
+		clip.h += clip.y;
+		clip.y = 0;
+	}
+	if (clip.x >= dst_surface->w || clip.y >= dst_surface->h)
+		return 0;
+	if (clip.w > dst_surface->w - clip.x)
+		clip.w = dst_surface->w - clip.x;
+	if (clip.h > dst_surface->h - clip.y)
+		clip.h = dst_surface->h - clip.y;
+
+	get_sel_surface(&s, dst_surface, &clip);
+	if (s.w <= 0 || s.h <= 0)
+		return 0;
+
+	fmt = &fmts[s.format];
+	c_w = s.w / fmt->c_ss_horz;
+	c_h = s.h / fmt->c_ss_vert;
+
+	if (is_rgb(s.format)) {
+		int r = (argb >> 16) & 0xff;
+		int g = (argb >> 8) & 0xff;
+		int b = argb & 0xff;
+
+		if (s.format == REN_RGB565) {
+			uint16_t v = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+			memcpy(pat, &v, 2);
+		} else if (s.format == REN_RGB24) {
+			pat[0] = r; pat[1] = g; pat[2] = b;
+		} else if (s.format == REN_BGR24) {
+			pat[0] = b; pat[1] = g; pat[2] = r;
+		} else {
+			memcpy(pat, &argb, 4);
+		}
+		fill_plane(s.py, size_y(s.format, s.pitch), s.h, pat, fmt->y_bpp, s.w);
+	} else {
+		argb_to_ycbcr(veu, argb, &y, &cb, &cr);
+
+		if (s.format == REN_YUYV || s.format == REN_UYVY) {
+			if (s.format == REN_YUYV) {
+				pat[0] = y; pat[1] = cb; pat[2] = y; pat[3] = cr;
+			} else {
+				pat[0] = cb; pat[1] = y; pat[2] = cr; pat[3] = y;
+			}
+			fill_plane(s.py, size_y(s.format, s.pitch), s.h, pat, 4, s.w / 2);
+		} else {
+			fill_plane(s.py, s.pitch, s.h, &y, 1, s.w);
+
+			if (is_planar(s.format)) {
+				fill_plane(s.pc, c_pitch(&s), c_h, &cb, 1, c_w);
+				fill_plane(s.pcr, c_pitch(&s), c_h, &cr, 1, c_w);
+			} else if (fmt->c_bpp) {
+				pat[0] = is_crcb(s.format) ? cr : cb;
+				pat[1] = is_crcb(s.format) ? cb : cr;
+				fill_plane(s.pc, c_pitch(&s), c_h, pat, 2, c_w);
+			}
+		}
+	}
+
+	fill_plane(s.pa, s.pitch, s.h, &alpha, 1, s.w);
+
+	return 0;
+}
+
+int
+shveu_fill_border(
+	SHVEU *veu,
+	const struct ren_vid_surface *dst_surface,
+	const struct ren_vid_rect *inner,
+	uint32_t argb)
+{
+	struct ren_vid_rect r[4];
+	int i;
+
+	if (!dst_surface || !inner)
+		return -1;
+
+	/* Above, below, left & right of the inner rectangle */
+	r[0].x = 0;
+	r[0].y = 0;
+	r[0].w = dst_surface->w;
+	r[0].h = inner->y;
+
+	r[1].x = 0;
+	r[1].y = inner->y + inner->h;
+	r[1].w = dst_surface->w;
+	r[1].h = dst_surface->h - r[1].y;
+
+	r[2].x = 0;
+	r[2].y = inner->y;
+	r[2].w = inner->x;
+	r[2].h = inner->h;
+
+	r[3].x = inner->x + inner->w;
+	r[3].y = inner->y;
+	r[3].w = dst_surface->w - r[3].x;
+	r[3].h = inner->h;
+
+	for (i=0; i<4; i++) {
+		if (r[i].w > 0 && r[i].h > 0
+		    && shveu_fill_rect(veu, dst_surface, &r[i], argb) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Centre a span of len in a span of size, aligned to inc */
+static int centre(int size, int len, int inc)
+{
+	return ((size - len) / 2) & ~(inc - 1);
+}
+
+int
+shveu_fit_rects(
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_fit_t mode,
+	struct ren_vid_rect *src_sel,
+	struct ren_vid_rect *dst_sel)
+{
+	const struct ren_vid_surface *s = src_surface;
+	const struct ren_vid_surface *d = dst_surface;
+	int s_hinc, s_vinc, d_hinc, d_vinc;
+	int src_wider;
+
+	if (!s || !d || !src_sel || !dst_sel || s->w <= 0 || s->h <= 0 || d->w <= 0 || d->h <= 0)
+		return -1;
+
+	s_hinc = horz_increment(s->format);
+	s_vinc = vert_increment(s->format);
+	d_hinc = horz_increment(d->format);
+	d_vinc = vert_increment(d->format);
+
+	src_sel->x = 0;
+	src_sel->y = 0;
+	src_sel->w = s->w;
+	src_sel->h = s->h;
+	dst_sel->x = 0;
+	dst_sel->y = 0;
+	dst_sel->w = d->w;
+	dst_sel->h = d->h;
+
+	src_wider = (long long)s->w * d->h > (long long)d->w * s->h;
+
+	if (mode == SHVEU_FIT) {
+		/* Whole input, with borders on two sides of the output */
+		if (src_wider)
+			dst_sel->h = ((long long)d->w * s->h / s->w) & ~(d_vinc - 1);
+		else
+			dst_sel->w = ((long long)d->h * s->w / s->h) & ~(d_hinc - 1);
+		dst_sel->x = centre(d->w, dst_sel->w, d_hinc);
+		dst_sel->y = centre(d->h, dst_sel->h, d_vinc);
+	} else if (mode == SHVEU_FILL) {
+		/* Whole output, with two sides of the input cropped */
+		if (src_wider)
+			src_sel->w = ((long long)s->h * d->w / d->h) & ~(s_hinc - 1);
+		else
+			src_sel->h = ((long long)s->w * d->h / d->w) & ~(s_vinc - 1);
+		src_sel->x = centre(s->w, src_sel->w, s_hinc);
+		src_sel->y = centre(s->h, src_sel->h, s_vinc);
+	} else if (mode != SHVEU_STRETCH) {
+		return -1;
+	}
+
+	if (src_sel->w <= 0 || src_sel->h <= 0 || dst_sel->w <= 0 || dst_sel->h <= 0)
+		return -1;
+
+	return 0;
+}
+
+int
+shveu_fit(
+	SHVEU *veu,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_fit_t mode,
+	uint32_t border)
+{
+	struct ren_vid_rect src_sel, dst_sel;
+	struct ren_vid_surface src, dst;
+	int ret;
+
+	if (shveu_fit_rects(src_surface, dst_surface, mode, &src_sel, &dst_sel) < 0)
+		return -1;
+
+	get_sel_surface(&src, src_surface, &src_sel);
+	get_sel_surface(&dst, dst_surface, &dst_sel);
+
+	ret = shveu_setup(veu, &src, &dst, SHVEU_NO_ROT);
+	if (ret < 0)
+		return ret;
+
+	shveu_start(veu);
+
+	/* The borders don't overlap the output, so fill them while the VEU runs */
+	shveu_fill_border(veu, dst_surface, &dst_sel, border);
+
+	if (shveu_wait(veu) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct shveu_context {
+	struct shveu_context *next;	/* ring of the contexts of a VEU */
+	SHVEU *veu;
+	int weight;
+	int credits;			/* turns left before the next context */
+	int waiting;
+	uint32_t regs[VEU_REG_WORDS];
+};
+
+/* Registers that hold the state of an operation */
+static const int state_regs[] = {
+	VESWR, VESSR, VSAYR, VSACR, VBSSR, VEDWR, VDAYR, VDACR,
+	VTRCR, VRFCR, VRFSR, VFMCR, VSWPR,
+};
+
+static const int veu2h_state_regs[] = {
+	VMCR00, VMCR01, VMCR02, VMCR10, VMCR11, VMCR12,
+	VMCR20, VMCR21, VMCR22, VCOFFR,
+};
+
+/* Registers that are checked to see if the VEU still holds our state, as
+ * any other user will have set its own buffer addresses */
+static const int signature_regs[] = {
+	VSAYR, VDAYR, VTRCR, VRFCR,
+};
+
+#define NR(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static void load_reg(SHVEU *veu, const uint32_t *regs, int reg, int full)
+{
+	uint32_t value = regs[reg / 4];
+
+	if (full || veu->hw_regs[reg / 4] != value) {
+		write_reg(veu->uio_mmio.iomem, value, reg);
+		veu->hw_regs[reg / 4] = value;
+	}
+}
+
+/* Read the state of the operation set up in the VEU */
+static void save_context(SHVEU *veu, uint32_t *regs)
+{
+	void *base_addr = veu->uio_mmio.iomem;
+	int i;
+
+	for (i=0; i<NR(state_regs); i++)
+		regs[state_regs[i] / 4] = read_reg(base_addr, state_regs[i]);
+	if (veu_is_veu2h(veu)) {
+		for (i=0; i<NR(veu2h_state_regs); i++)
+			regs[veu2h_state_regs[i] / 4] = read_reg(base_addr, veu2h_state_regs[i]);
+	} else {
+		regs[VRPBR / 4] = read_reg(base_addr, VRPBR);
+	}
+}
+
+/* Load a context register image, only writing the registers that differ
+ * from the last image loaded if the VEU still holds it */
+static void load_context(SHVEU *veu, const uint32_t *regs)
+{
+	void *base_addr = veu->uio_mmio.iomem;
+	int full = !veu->hw_regs_valid;
+	int i;
+
+	for (i=0; i<NR(signature_regs) && !full; i++) {
+		int reg = signature_regs[i];
+		if (read_reg(base_addr, reg) != veu->hw_regs[reg / 4])
+			full = 1;
+	}
+
+	if (full) {
+		/* Software & module reset, as per veu_setup() */
+		soft_reset(veu, base_addr);
+		write_reg(base_addr, 0x100, VBSRR);
+	}
+
+	write_reg(base_addr, 0, VEVTR);
+
+	for (i=0; i<NR(state_regs); i++)
+		load_reg(veu, regs, state_regs[i], full);
+	if (veu_is_veu2h(veu)) {
+		for (i=0; i<NR(veu2h_state_regs); i++)
+			load_reg(veu, regs, veu2h_state_regs[i], full);
+	} else {
+		load_reg(veu, regs, VRPBR, full);
+	}
+
+	veu->hw_regs_valid = 1;
+}
+
+/* How long the VEU is held for a context with turns left, for the thread
+ * of the context to submit its next operation */
+#define CTX_HOLD_US 2000
+
+static int others_waiting(SHVEU *veu, struct shveu_context *ctx)
+{
+	struct shveu_context *other;
+
+	for (other = ctx->next; other != ctx; other = other->next) {
+		if (other->waiting)
+			return 1;
+	}
+	return 0;
+}
+
+/* Grant the VEU to the next waiting context: the current context keeps it
+ * until it has used up its weight, then the next in the ring gets it. If
+ * hold is set, the current context has just finished an operation, so the
+ * VEU is held for it while it has turns left, even if it isn't waiting
+ * yet. */
+static void grant_next(SHVEU *veu, int hold)
+{
+	struct shveu_context *ctx = veu->ctx_current;
+	struct shveu_context *next;
+
+	veu->ctx_granted = NULL;
+	veu->ctx_hold_until = 0;
+
+	if (ctx && ctx->credits > 0) {
+		if (ctx->waiting) {
+			ctx->credits--;
+			veu->ctx_granted = ctx;
+			return;
+		}
+		if (hold && others_waiting(veu, ctx)) {
+			ctx->credits--;
+			veu->ctx_granted = ctx;
+			veu->ctx_hold_until = now_us() + CTX_HOLD_US;
+			return;
+		}
+	}
+
+	next = ctx ? ctx->next : veu->ctx_ring;
+	if (!next)
+		return;
+	ctx = next;
+	do {
+		if (ctx->waiting) {
+			ctx->credits = ctx->weight - 1;
+			veu->ctx_current = ctx;
+			veu->ctx_granted = ctx;
+			return;
+		}
+		ctx = ctx->next;
+	} while (ctx != next);
+}
+
+struct shveu_context *
+shveu_context_new(
+	SHVEU *veu,
+	int weight)
+{
+	struct shveu_context *ctx;
+
+	if (!veu)
+		return NULL;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->veu = veu;
+	ctx->weight = (weight < 1) ? 1 : weight;
+
+	pthread_mutex_lock(&veu->ctx_mutex);
+	if (veu->ctx_ring) {
+		ctx->next = veu->ctx_ring->next;
+		veu->ctx_ring->next = ctx;
+	} else {
+		ctx->next = ctx;
+		veu->ctx_ring = ctx;
+	}
+	pthread_mutex_unlock(&veu->ctx_mutex);
+
+	return ctx;
+}
+
+void
+shveu_context_free(
+	struct shveu_context *ctx)
+{
+	SHVEU *veu;
+	struct shveu_context *prev;
+
+	if (!ctx)
+		return;
+	veu = ctx->veu;
+
+	pthread_mutex_lock(&veu->ctx_mutex);
+	for (prev = ctx; prev->next != ctx; prev = prev->next)
+		;
+	if (prev == ctx) {
+		veu->ctx_ring = NULL;
+	} else {
+		prev->next = ctx->next;
+		if (veu->ctx_ring == ctx)
+			veu->ctx_ring = ctx->next;
+	}
+	if (veu->ctx_current == ctx)
+		veu->ctx_current = (prev == ctx) ? NULL : prev;
+	if (veu->ctx_granted == ctx) {
+		/* Held for this context, pass it on */
+		grant_next(veu, 0);
+		pthread_cond_broadcast(&veu->ctx_turn);
+	}
+	pthread_mutex_unlock(&veu->ctx_mutex);
+
+	free(ctx);
+}
+
+int
+shveu_context_run(
+	struct shveu_context *ctx,
+	const struct ren_vid_surface *src_surface,
+	const struct ren_vid_surface *dst_surface,
+	shveu_rotation_t filter_control)
+{
+	SHVEU *veu;
+	int ret;
+
+	if (!ctx)
+		return -1;
+	veu = ctx->veu;
+
+	/* Wait for our turn */
+	pthread_mutex_lock(&veu->ctx_mutex);
+	ctx->waiting = 1;
+	if (!veu->ctx_busy && !veu->ctx_granted)
+		grant_next(veu, 0);
+	while (veu->ctx_granted != ctx) {
+		long long left;
+		struct timespec ts;
+
+		if (!veu->ctx_hold_until) {
+			pthread_cond_wait(&veu->ctx_turn, &veu->ctx_mutex);
+			continue;
+		}
+
+		left = veu->ctx_hold_until - now_us();
+		if (left <= 0) {
+			/* The held context has nothing more to run, so its
+			 * round is over */
+			veu->ctx_granted->credits = 0;
+			grant_next(veu, 0);
+			pthread_cond_broadcast(&veu->ctx_turn);
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += left / 1000000;
+		ts.tv_nsec += (left % 1000000) * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&veu->ctx_turn, &veu->ctx_mutex, &ts);
+	}
+	ctx->waiting = 0;
+	veu->ctx_granted = NULL;
+	veu->ctx_hold_until = 0;
+	veu->ctx_busy = 1;
+	pthread_mutex_unlock(&veu->ctx_mutex);
+
+	/* Set up the register image rather than the VEU */
+	veu->reg_image = ctx->regs;
+	ret = veu_setup(veu, src_surface, dst_surface, filter_control, 1);
+	veu->reg_image = NULL;
+
+	if (ret == 0) {
+		if (!veu->cpu_op && veu->client_fd < 0)
+			load_context(veu, ctx->regs);
+		shveu_start(veu);
+		if (shveu_wait(veu) < 0)
+			ret = -1;
+	}
+
+	pthread_mutex_lock(&veu->ctx_mutex);
+	veu->ctx_busy = 0;
+	grant_next(veu, 1);
+	pthread_cond_broadcast(&veu->ctx_turn);
+	pthread_mutex_unlock(&veu->ctx_mutex);
+
+	return ret;
+}
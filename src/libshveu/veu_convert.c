@@ -0,0 +1,360 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Pixel conversion kernels.
+ *
+ * These are used to fuse format conversions into the copies that are made
+ * when a surface is not accessible by the VEU, so that the data is only
+ * traversed once. NEON is used where available, otherwise the rows are
+ * processed a 32-bit word at a time when the pointers allow it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#include "veu_convert.h"
+
+#define ALIGNED4(p) ((((uintptr_t)(p)) & 3) == 0)
+
+/* 0x0000abcd -> 0x00ab00cd */
+static inline uint32_t spread16(uint32_t x)
+{
+	return (x & 0xff) | ((x & 0xff00) << 8);
+}
+
+/* 0x??ab??cd -> 0x0000abcd */
+static inline uint32_t squeeze16(uint32_t x)
+{
+	return (x & 0xff) | ((x >> 8) & 0xff00);
+}
+
+void veu_interleave(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n)
+{
+	int i = 0;
+
+#ifdef __ARM_NEON__
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t v;
+		v.val[0] = vld1q_u8(a + i);
+		v.val[1] = vld1q_u8(b + i);
+		vst2q_u8(dst + 2*i, v);
+	}
+#else
+	if (ALIGNED4(dst) && ALIGNED4(a) && ALIGNED4(b)) {
+		uint32_t *d = (uint32_t *)dst;
+		const uint32_t *wa = (const uint32_t *)a;
+		const uint32_t *wb = (const uint32_t *)b;
+
+		for (; i + 4 <= n; i += 4) {
+			uint32_t x = *wa++;
+			uint32_t y = *wb++;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			*d++ = spread16(x & 0xffff) | (spread16(y & 0xffff) << 8);
+			*d++ = spread16(x >> 16) | (spread16(y >> 16) << 8);
+#else
+			*d++ = (spread16(x >> 16) << 8) | spread16(y >> 16);
+			*d++ = (spread16(x & 0xffff) << 8) | spread16(y & 0xffff);
+#endif
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[2*i]   = a[i];
+		dst[2*i+1] = b[i];
+	}
+}
+
+void veu_deinterleave(uint8_t *a, uint8_t *b, const uint8_t *src, int n)
+{
+	int i = 0;
+
+#ifdef __ARM_NEON__
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t v = vld2q_u8(src + 2*i);
+		vst1q_u8(a + i, v.val[0]);
+		vst1q_u8(b + i, v.val[1]);
+	}
+#else
+	if (ALIGNED4(src) && ALIGNED4(a) && ALIGNED4(b)) {
+		const uint32_t *s = (const uint32_t *)src;
+		uint32_t *wa = (uint32_t *)a;
+		uint32_t *wb = (uint32_t *)b;
+
+		for (; i + 4 <= n; i += 4) {
+			uint32_t x = *s++;
+			uint32_t y = *s++;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			*wa++ = squeeze16(x) | (squeeze16(y) << 16);
+			*wb++ = squeeze16(x >> 8) | (squeeze16(y >> 8) << 16);
+#else
+			*wa++ = (squeeze16(x >> 8) << 16) | squeeze16(y >> 8);
+			*wb++ = (squeeze16(x) << 16) | squeeze16(y);
+#endif
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		a[i] = src[2*i];
+		b[i] = src[2*i+1];
+	}
+}
+
+void veu_swap_pairs(uint8_t *dst, const uint8_t *src, int n)
+{
+	int i = 0;
+
+#ifdef __ARM_NEON__
+	for (; i + 8 <= n; i += 8)
+		vst1q_u8(dst + 2*i, vrev16q_u8(vld1q_u8(src + 2*i)));
+#else
+	if (ALIGNED4(dst) && ALIGNED4(src)) {
+		uint32_t *d = (uint32_t *)dst;
+		const uint32_t *s = (const uint32_t *)src;
+
+		/* Independent of byte order */
+		for (; i + 2 <= n; i += 2) {
+			uint32_t x = *s++;
+			*d++ = ((x & 0x00ff00ff) << 8) | ((x >> 8) & 0x00ff00ff);
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint8_t tmp = src[2*i];
+		dst[2*i]   = src[2*i+1];
+		dst[2*i+1] = tmp;
+	}
+}
+
+void veu_fill_row(uint8_t *dst, const uint8_t *pattern, int size, int n)
+{
+	size_t len = (size_t)size * n;
+	size_t done;
+
+	if (n <= 0)
+		return;
+	if (size == 1) {
+		memset(dst, pattern[0], n);
+		return;
+	}
+
+	/* Double the filled part each time, so most of the row is written by
+	 * large memcpy calls, which use the widest stores available */
+	memcpy(dst, pattern, size);
+	for (done = size; done < len; done *= 2)
+		memcpy(dst + done, dst, (len - done < done) ? len - done : done);
+}
+
+#define FNV32_PRIME 16777619u
+#define FNV64_PRIME 0x100000001b3ull
+
+uint64_t veu_hash(uint64_t seed, const uint8_t *src, int len)
+{
+	uint32_t lane[4];
+	uint64_t h = seed;
+	int i = 0;
+	int j;
+
+	for (j=0; j<4; j++)
+		lane[j] = (uint32_t)(seed >> (j * 8)) ^ 0x811c9dc5;
+
+#ifdef __ARM_NEON__
+	{
+		uint32x4_t acc = vld1q_u32(lane);
+
+		for (; i + 16 <= len; i += 16) {
+			uint32x4_t x = vreinterpretq_u32_u8(vld1q_u8(src + i));
+			acc = vmulq_n_u32(veorq_u32(acc, x), FNV32_PRIME);
+		}
+		vst1q_u32(lane, acc);
+	}
+#else
+	/* Four independent lanes, so the compiler can keep them in registers */
+	for (; i + 16 <= len; i += 16) {
+		uint32_t x[4];
+
+		memcpy(x, src + i, sizeof(x));
+		for (j=0; j<4; j++)
+			lane[j] = (lane[j] ^ x[j]) * FNV32_PRIME;
+	}
+#endif
+
+	for (; i < len; i++)
+		lane[0] = (lane[0] ^ src[i]) * FNV32_PRIME;
+
+	for (j=0; j<4; j++)
+		h = (h ^ lane[j]) * FNV64_PRIME;
+
+	return (h ^ (uint64_t)len) * FNV64_PRIME;
+}
+
+static void copy_alpha(const struct veu_alpha *dst, const struct veu_alpha *src)
+{
+	int x, y;
+
+	for (y=0; y<src->h; y++) {
+		uint8_t *d = dst->p + y * dst->pitch;
+		const uint8_t *s = src->p + y * src->pitch;
+
+		if (dst->step == 1 && src->step == 1) {
+			memcpy(d, s, src->w);
+		} else {
+			for (x=0; x<src->w; x++) {
+				*d = *s;
+				d += dst->step;
+				s += src->step;
+			}
+		}
+	}
+}
+
+/* Rotation (no scaling), mirroring variants as per VFMCR */
+static void rotate_alpha(const struct veu_alpha *dst, const struct veu_alpha *src, int filter_control)
+{
+	int sw = src->w;
+	int sh = src->h;
+	int dx, dy, sx, sy;
+
+	for (dy=0; dy<dst->h; dy++) {
+		uint8_t *d = dst->p + dy * dst->pitch;
+
+		for (dx=0; dx<dst->w; dx++) {
+			switch (filter_control & 0xFF) {
+			case 0x11:	/* Rotate 90 & Mirror Horizontal */
+				sx = dy;
+				sy = dx;
+				break;
+			case 0x21:	/* Rotate 90 & Mirror Vertical */
+				sx = sw - 1 - dy;
+				sy = sh - 1 - dx;
+				break;
+			case 0x02:	/* Rotate 270 */
+				sx = sw - 1 - dy;
+				sy = dx;
+				break;
+			default:	/* Rotate 90 */
+				sx = dy;
+				sy = sh - 1 - dx;
+				break;
+			}
+			if (sx < 0 || sx >= sw || sy < 0 || sy >= sh)
+				continue;
+			d[dx * dst->step] = src->p[sy * src->pitch + sx * src->step];
+		}
+	}
+}
+
+int veu_scale_alpha(const struct veu_alpha *dst, const struct veu_alpha *src, int filter_control)
+{
+	int mirror_h = filter_control & 0x10;
+	int mirror_v = filter_control & 0x20;
+	uint32_t x_inc, y_inc;
+	uint32_t *x_pos;
+	int dx, dy;
+
+	if (filter_control & 0x3) {
+		rotate_alpha(dst, src, filter_control);
+		return 0;
+	}
+
+	if (dst->w == src->w && dst->h == src->h && !mirror_h && !mirror_v) {
+		copy_alpha(dst, src);
+		return 0;
+	}
+
+	/* Bilinear, 16.16 fixed point with end points aligned as per the VEU */
+	x_inc = (dst->w > 1) ? ((src->w - 1) << 16) / (dst->w - 1) : 0;
+	y_inc = (dst->h > 1) ? ((src->h - 1) << 16) / (dst->h - 1) : 0;
+
+	/* Horizontal positions are the same for every line */
+	x_pos = malloc(dst->w * sizeof(*x_pos));
+	if (!x_pos)
+		return -1;
+	for (dx=0; dx<dst->w; dx++)
+		x_pos[dx] = dx * x_inc;
+
+	for (dy=0; dy<dst->h; dy++) {
+		uint32_t y_fix = dy * y_inc;
+		int y0 = y_fix >> 16;
+		int y1 = (y0 + 1 < src->h) ? y0 + 1 : y0;
+		uint32_t fy = (y_fix >> 8) & 0xff;
+		const uint8_t *r0 = src->p + y0 * src->pitch;
+		const uint8_t *r1 = src->p + y1 * src->pitch;
+		uint8_t *d = dst->p + (mirror_v ? dst->h - 1 - dy : dy) * dst->pitch;
+		int d_step = dst->step;
+
+		if (mirror_h) {
+			d += (dst->w - 1) * dst->step;
+			d_step = -d_step;
+		}
+
+		for (dx=0; dx<dst->w; dx++) {
+			int x0 = x_pos[dx] >> 16;
+			int x1 = (x0 + 1 < src->w) ? x0 + 1 : x0;
+			uint32_t fx = (x_pos[dx] >> 8) & 0xff;
+			uint32_t top, bot;
+
+			x0 *= src->step;
+			x1 *= src->step;
+			top = r0[x0] * (256 - fx) + r0[x1] * fx;
+			bot = r1[x0] * (256 - fx) + r1[x1] * fx;
+			*d = (top * (256 - fy) + bot * fy + 32768) >> 16;
+			d += d_step;
+		}
+	}
+
+	free(x_pos);
+	return 0;
+}
+
+void veu_fill_alpha(const struct veu_alpha *dst, uint8_t value)
+{
+	int x, y;
+
+	for (y=0; y<dst->h; y++) {
+		uint8_t *d = dst->p + y * dst->pitch;
+
+		if (dst->step == 1) {
+			memset(d, value, dst->w);
+		} else {
+			for (x=0; x<dst->w; x++) {
+				*d = value;
+				d += dst->step;
+			}
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Pixel conversion kernels used when copying surfaces to and from buffers
+ * that the VEU can access.
+ */
+
+#ifndef __VEU_CONVERT_H__
+#define __VEU_CONVERT_H__
+
+#include <stdint.h>
+
+/* Interleave two chroma rows: dst = a0 b0 a1 b1 ... (n samples from each) */
+void veu_interleave(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n);
+
+/* Split an interleaved chroma row: a = dst0 dst2 ..., b = dst1 dst3 ... */
+void veu_deinterleave(uint8_t *a, uint8_t *b, const uint8_t *src, int n);
+
+/* Swap the bytes of each pair: dst = src1 src0 src3 src2 ... (n pairs) */
+void veu_swap_pairs(uint8_t *dst, const uint8_t *src, int n);
+
+/* Fill a row with n copies of a pattern of size bytes */
+void veu_fill_row(uint8_t *dst, const uint8_t *pattern, int size, int n);
+
+/* Hash a row of bytes, chained from seed. Not cryptographic. */
+uint64_t veu_hash(uint64_t seed, const uint8_t *src, int len);
+
+/* An alpha plane, or the alpha channel of a packed surface */
+struct veu_alpha {
+	uint8_t *p;	/* first alpha value */
+	int pitch;	/* bytes per line */
+	int step;	/* bytes per pixel */
+	int w;
+	int h;
+};
+
+/* Scale/rotate alpha with the same geometry as the VEU filter mode (VFMCR) */
+int veu_scale_alpha(const struct veu_alpha *dst, const struct veu_alpha *src, int filter_control);
+
+/* Set all alpha values */
+void veu_fill_alpha(const struct veu_alpha *dst, uint8_t value);
+
+#endif /* __VEU_CONVERT_H__ */
@@ -0,0 +1,118 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Anonymous files and surface checks, see veu_shm.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#include "veu_shm.h"
+
+/* Not all C libraries know about memfd */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+int veu_shm_create(const char *name, int *sealable)
+{
+	int fd = -1;
+
+	*sealable = 0;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	*sealable = (fd >= 0);
+#endif
+	if (fd < 0) {
+		char path[] = "/tmp/shveu-XXXXXX";
+		fd = mkstemp(path);
+		if (fd < 0)
+			return -1;
+		unlink(path);
+	}
+
+	return fd;
+}
+
+void veu_shm_seal(int fd)
+{
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+}
+
+/* Larger than any surface the VEU can process */
+#define MAX_DIMENSION 0x4000
+
+int veu_shm_plane_sizes(ren_vid_format_t format, int w, int h, int pitch,
+	size_t *y, size_t *c, size_t *a)
+{
+	size_t pixels;
+
+	if (format <= REN_UNKNOWN || format > REN_Y8)
+		return -1;
+	if (w <= 0 || h <= 0 || pitch < w || pitch > MAX_DIMENSION || h > MAX_DIMENSION)
+		return -1;
+
+	pixels = (size_t)pitch * h;
+	*y = size_y(format, pixels);
+	*c = size_c(format, pixels);
+	if (is_planar(format))
+		*c /= 2;
+	*a = size_a(format, pixels);
+
+	return 0;
+}
+
+void *veu_shm_map(UIOMux *uiomux, uiomux_resource_t res, unsigned long phys, size_t len)
+{
+	unsigned char *start, *end;
+
+	if (!phys || !len || phys + (len - 1) < phys)
+		return NULL;
+
+	/* Both ends must be mapped, and the same distance apart as in
+	 * physical memory */
+	start = uiomux_phys_to_virt(uiomux, res, phys);
+	end = uiomux_phys_to_virt(uiomux, res, phys + (len - 1));
+	if (!start || !end || end < start || (size_t)(end - start) != len - 1)
+		return NULL;
+
+	return start;
+}
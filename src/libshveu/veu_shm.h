@@ -0,0 +1,56 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Anonymous files, for sharing small amounts of memory between processes,
+ * and checks of surfaces described by other processes.
+ */
+
+#ifndef __VEU_SHM_H__
+#define __VEU_SHM_H__
+
+#include <stddef.h>
+
+#include <uiomux/uiomux.h>
+#include "shveu/shveu.h"
+
+/* Create an anonymous file, a memfd where the kernel supports it.
+ * sealable is set if seals can be added to the file with veu_shm_seal().
+ * Returns the file descriptor, or -1. */
+int veu_shm_create(const char *name, int *sealable);
+
+/* Prevent any further change to the size or contents of the file */
+void veu_shm_seal(int fd);
+
+/* Bytes used by each plane of a surface, c being the size of each chroma
+ * plane. Returns -1 if the surface size is not sensible. */
+int veu_shm_plane_sizes(ren_vid_format_t format, int w, int h, int pitch,
+	size_t *y, size_t *c, size_t *a);
+
+/* Map len bytes at phys, if they all lie within one uiomux region.
+ * Returns the virtual address, or NULL. */
+void *veu_shm_map(UIOMux *uiomux, uiomux_resource_t res, unsigned long phys, size_t len);
+
+#endif /* __VEU_SHM_H__ */
@@ -0,0 +1,231 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "veu_stats.h"
+
+#define BLOCK_SIZE 8
+
+int veu_stats_begin(struct veu_stats *st, struct shveu_stats *out, int w)
+{
+	int nr_blocks = (w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	memset(out, 0, sizeof(*out));
+	out->min = 255;
+
+	st->out = out;
+	st->w = w;
+	st->row = 0;
+	st->luma = malloc(w + 2 * nr_blocks);
+	if (!st->luma)
+		return -1;
+	st->bmin = st->luma + w;
+	st->bmax = st->bmin + nr_blocks;
+	memset(st->bmin, 255, nr_blocks);
+	memset(st->bmax, 0, nr_blocks);
+
+	return 0;
+}
+
+/* Add the range of each 8x8 block to the activity and start new blocks */
+static void flush_blocks(struct veu_stats *st)
+{
+	int nr_blocks = (st->w + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int b;
+
+	for (b=0; b<nr_blocks; b++)
+		st->out->activity += st->bmax[b] - st->bmin[b];
+	st->out->nr_blocks += nr_blocks;
+
+	memset(st->bmin, 255, nr_blocks);
+	memset(st->bmax, 0, nr_blocks);
+}
+
+static void luma_row(struct veu_stats *st, const uint8_t *y, int w, int add_sum)
+{
+	struct shveu_stats *out = st->out;
+	unsigned long sum = 0;
+	int lo = out->min;
+	int hi = out->max;
+	int x, b;
+
+	for (b=0, x=0; x<w; b++) {
+		int end = (x + BLOCK_SIZE < w) ? x + BLOCK_SIZE : w;
+		int bmin = st->bmin[b];
+		int bmax = st->bmax[b];
+
+		for (; x<end; x++) {
+			int v = y[x];
+			out->hist[v]++;
+			sum += v;
+			if (v < bmin) bmin = v;
+			if (v > bmax) bmax = v;
+		}
+		st->bmin[b] = bmin;
+		st->bmax[b] = bmax;
+		if (bmin < lo) lo = bmin;
+		if (bmax > hi) hi = bmax;
+	}
+
+	out->min = lo;
+	out->max = hi;
+	out->nr_pixels += w;
+	if (add_sum)
+		out->sum[0] += sum;
+}
+
+/* Sum of every step'th byte */
+static unsigned long sum_bytes(const uint8_t *p, int step, int n)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i=0; i<n; i++)
+		sum += p[i * step];
+	return sum;
+}
+
+static void chroma_rows(struct veu_stats *st, const struct ren_vid_surface *s, int y)
+{
+	const struct format_info *fmt = &fmts[s->format];
+	int n = s->w / fmt->c_ss_horz;
+	int c = y / fmt->c_ss_vert;
+	int pitch = fmt->c_bpp * s->pitch / fmt->c_ss_horz;
+	int cb = is_crcb(s->format) ? 1 : 0;
+
+	if (y % fmt->c_ss_vert)
+		return;
+
+	if (is_planar(s->format)) {
+		st->out->sum[1] += sum_bytes(s->pc + c * pitch, 1, n);
+		st->out->sum[2] += sum_bytes(s->pcr + c * pitch, 1, n);
+	} else {
+		const uint8_t *p = s->pc + c * pitch;
+		st->out->sum[1] += sum_bytes(p + cb, 2, n);
+		st->out->sum[2] += sum_bytes(p + 1 - cb, 2, n);
+	}
+	st->out->nr_chroma += n;
+}
+
+/* Packed 4:2:2, Y0 Cb Y1 Cr (YUYV) or Cb Y0 Cr Y1 (UYVY) */
+static const uint8_t *packed_row(struct veu_stats *st, const struct ren_vid_surface *s, int y)
+{
+	const uint8_t *p = s->py + size_y(s->format, y * s->pitch);
+	int yoff = (s->format == REN_YUYV) ? 0 : 1;
+	int x;
+
+	for (x=0; x<s->w; x++)
+		st->luma[x] = p[2*x + yoff];
+
+	st->out->sum[1] += sum_bytes(p + 1 - yoff, 4, s->w / 2);
+	st->out->sum[2] += sum_bytes(p + 3 - yoff, 4, s->w / 2);
+	st->out->nr_chroma += s->w / 2;
+
+	return st->luma;
+}
+
+/* RGB, with luma approximated as (77R + 150G + 29B) / 256 */
+static const uint8_t *rgb_row(struct veu_stats *st, const struct ren_vid_surface *s, int y)
+{
+	const uint8_t *p = s->py + size_y(s->format, y * s->pitch);
+	unsigned long r_sum = 0, g_sum = 0, b_sum = 0;
+	int x;
+
+	for (x=0; x<s->w; x++) {
+		int r, g, b;
+
+		if (s->format == REN_RGB565) {
+			uint16_t v = ((const uint16_t *)p)[x];
+			r = (v >> 8) & 0xf8;
+			g = (v >> 3) & 0xfc;
+			b = (v << 3) & 0xf8;
+		} else if (s->format == REN_RGB24) {
+			r = p[3*x];
+			g = p[3*x+1];
+			b = p[3*x+2];
+		} else if (s->format == REN_BGR24) {
+			b = p[3*x];
+			g = p[3*x+1];
+			r = p[3*x+2];
+		} else {
+			uint32_t v = ((const uint32_t *)p)[x];
+			r = (v >> 16) & 0xff;
+			g = (v >> 8) & 0xff;
+			b = v & 0xff;
+		}
+		r_sum += r;
+		g_sum += g;
+		b_sum += b;
+		st->luma[x] = (77 * r + 150 * g + 29 * b) >> 8;
+	}
+
+	st->out->sum[0] += r_sum;
+	st->out->sum[1] += g_sum;
+	st->out->sum[2] += b_sum;
+	st->out->nr_chroma += s->w;
+
+	return st->luma;
+}
+
+void veu_stats_rows(struct veu_stats *st, const struct ren_vid_surface *s)
+{
+	int w = (s->w < st->w) ? s->w : st->w;
+	int y;
+
+	for (y=0; y<s->h; y++) {
+		const uint8_t *luma;
+
+		if (is_rgb(s->format)) {
+			luma = rgb_row(st, s, y);
+		} else if (is_packed_ycbcr(s->format)) {
+			luma = packed_row(st, s, y);
+		} else {
+			luma = s->py + y * s->pitch;
+			if (fmts[s->format].c_bpp)
+				chroma_rows(st, s, y);
+		}
+
+		luma_row(st, luma, w, !is_rgb(s->format));
+
+		if (++st->row % BLOCK_SIZE == 0)
+			flush_blocks(st);
+	}
+}
+
+void veu_stats_end(struct veu_stats *st)
+{
+	if (st->row % BLOCK_SIZE)
+		flush_blocks(st);
+	if (st->out->nr_pixels == 0)
+		st->out->min = 0;
+	free(st->luma);
+	st->luma = NULL;
+}
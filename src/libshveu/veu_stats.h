@@ -0,0 +1,55 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Surface statistics, collected a band of rows at a time while the rows are
+ * being copied to or from a buffer the VEU can access.
+ */
+
+#ifndef __VEU_STATS_H__
+#define __VEU_STATS_H__
+
+#include <stdint.h>
+
+#include "shveu/shveu.h"
+
+struct veu_stats {
+	struct shveu_stats *out;
+	int w;
+	int row;	/* rows processed so far */
+	uint8_t *luma;	/* one row of luma, for RGB & packed YCbCr */
+	uint8_t *bmin;	/* luma range of each 8x8 block in the current rows */
+	uint8_t *bmax;
+};
+
+/* Start collecting statistics of a surface of width w */
+int veu_stats_begin(struct veu_stats *st, struct shveu_stats *out, int w);
+
+/* Add the rows of s, which follow on from the rows already added */
+void veu_stats_rows(struct veu_stats *st, const struct ren_vid_surface *s);
+
+/* Finish off partial blocks and free working memory */
+void veu_stats_end(struct veu_stats *st);
+
+#endif /* __VEU_STATS_H__ */
@@ -36,13 +36,13 @@ usage (const char * progname)
 	printf ("If no input filename is specified, data is read from stdin.\n");
 	printf ("Specify '-' to force input to be read from stdin.\n");
 	printf ("\nInput options\n");
-	printf ("  -c, --input-colorspace (RGB565, RGB888, BGR888, RGBx888, NV12, YCbCr420, NV16, YCbCr422)\n");
+	printf ("  -c, --input-colorspace (RGB565, RGB888, BGR888, RGBx888, ARGB8888, NV12, YCbCr420, NV16, YCbCr422, I420, YV12, YUYV, UYVY, NV21, NV61, Y8)\n");
 	printf ("                         Specify input colorspace\n");
 	printf ("  -s, --input-size       Set the input image size (qcif, cif, qvga, vga, d1, 720p)\n");
 	printf ("\nOutput options\n");
 	printf ("  -o filename, --output filename\n");
 	printf ("                         Specify output filename (default: stdout)\n");
-	printf ("  -C, --output-colorspace (RGB565, RGB888, BGR888, RGBx888, NV12, YCbCr420, NV16, YCbCr422)\n");
+	printf ("  -C, --output-colorspace (RGB565, RGB888, BGR888, RGBx888, ARGB8888, NV12, YCbCr420, NV16, YCbCr422, I420, YV12, YUYV, UYVY, NV21, NV61, Y8)\n");
 	printf ("                         Specify output colorspace\n");
 	printf ("\nTransform options\n");
 	printf ("  Note that the VEU does not support combined rotation and scaling.\n");
@@ -122,6 +122,7 @@ static const struct extensions_t exts[] = {
 	{ "BGR888",   REN_BGR24 },
 	{ "RGBx888",  REN_RGB32 },
 	{ "x888",     REN_RGB32 },
+	{ "ARGB8888", REN_ARGB32 },
 	{ "YCbCr420", REN_NV12 },
 	{ "420",      REN_NV12 },
 	{ "yuv",      REN_NV12 },
@@ -129,6 +130,15 @@ static const struct extensions_t exts[] = {
 	{ "YCbCr422", REN_NV16 },
 	{ "422",      REN_NV16 },
 	{ "NV16",     REN_NV16 },
+	{ "I420",     REN_I420 },
+	{ "YV12",     REN_YV12 },
+	{ "YUYV",     REN_YUYV },
+	{ "YUY2",     REN_YUYV },
+	{ "UYVY",     REN_UYVY },
+	{ "NV21",     REN_NV21 },
+	{ "NV61",     REN_NV61 },
+	{ "Y8",       REN_Y8 },
+	{ "GREY",     REN_Y8 },
 };
 
 static int set_colorspace (char * arg, ren_vid_format_t * c)
@@ -194,6 +204,27 @@ static off_t imgsize (ren_vid_format_t colorspace, int w, int h)
 	return (off_t)(size_y(colorspace, w*h) + size_c(colorspace, w*h));
 }
 
+/* Set up the plane addresses for a contiguous image */
+static void set_planes (struct ren_vid_surface * s, void * buf)
+{
+	size_t c_size = size_c(s->format, s->w * s->h);
+
+	s->py = buf;
+	s->pc = 0;
+	s->pcr = 0;
+	s->pa = 0;
+
+	if (c_size)
+		s->pc = s->py + size_y(s->format, s->w * s->h);
+
+	if (s->format == REN_I420) {
+		s->pcr = s->pc + c_size/2;
+	} else if (s->format == REN_YV12) {
+		s->pcr = s->pc;
+		s->pc = s->pcr + c_size/2;
+	}
+}
+
 static int guess_colorspace (char * filename, ren_vid_format_t * c)
 {
 	char * ext;
@@ -249,6 +280,7 @@ int main (int argc, char * argv[])
 	struct ren_vid_surface src;
 	struct ren_vid_surface dst;
 	int ret;
+	int failed = 0;
 	int frameno=0;
 
 	int show_version = 0;
@@ -443,19 +475,8 @@ int main (int argc, char * argv[])
 	uiomux = uiomux_open ();
 
 	/* Set up memory buffers */
-	src.py = uiomux_malloc (uiomux, UIOMUX_SH_VEU, input_size, 32);
-	if (src.format == REN_RGB565) {
-		src.pc = 0;
-	} else {
-		src.pc = src.py + (src.w * src.h);
-	}
-
-	dst.py = uiomux_malloc (uiomux, UIOMUX_SH_VEU, output_size, 32);
-	if (dst.format == REN_RGB565) {
-		dst.pc = 0;
-	} else {
-		dst.pc = dst.py + (dst.w * dst.h);
-	}
+	set_planes (&src, uiomux_malloc (uiomux, UIOMUX_SH_VEU, input_size, 32));
+	set_planes (&dst, uiomux_malloc (uiomux, UIOMUX_SH_VEU, output_size, 32));
 
 	if (strcmp (infilename, "-") == 0) {
 		infile = stdin;
@@ -511,6 +532,11 @@ int main (int argc, char * argv[])
 		} else {
 			ret = shveu_resize(veu, &src, &dst);
 		}
+		if (ret < 0) {
+			fprintf (stderr, "%s: error converting frame %d\n",
+				 progname, frameno);
+			failed = 1;
+		}
 
 		/* Write output */
 		if (outfile && fwrite (dst.py, 1, output_size, outfile) != output_size) {
@@ -537,6 +563,8 @@ int main (int argc, char * argv[])
 
 	printf ("Frames:\t\t%d\n", frameno);
 
+	if (failed) goto exit_err;
+
 exit_ok:
 	exit (0);
 
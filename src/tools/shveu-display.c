@@ -52,9 +52,12 @@ usage (const char * progname)
 	printf ("  -s, --input-size       Set the input image size (qcif, cif, qvga, vga, d1, 720p)\n");
 	printf ("  -W, --width            Set the input image width\n");
 	printf ("  -H, --height           Set the input image height\n");
+	printf ("\nDisplay options\n");
+	printf ("  -f, --fit              Fit the image to the display (fit, fill, stretch)\n");
 	printf ("\nControl keys\n");
 	printf ("  +/-                    Zoom in/out\n");
 	printf ("  Cursor keys            Pan\n");
+	printf ("  f                      Fit, fill or stretch the image to the display\n");
 	printf ("  =                      Reset zoom and panning\n");
 	printf ("  q                      Quit\n");
 	printf ("\nMiscellaneous options\n");
@@ -269,6 +272,23 @@ elapsed_us (struct timespec * start)
 	return (secs*U_SEC_PER_SEC) + nsecs/1000;
 }
 
+static const char *fit_names[] = { "fit", "fill", "stretch" };
+#define NR_FIT_MODES ((int)(sizeof(fit_names) / sizeof(fit_names[0])))
+
+static int set_fit (char * arg, int * fit)
+{
+	int i;
+
+	for (i=0; i<NR_FIT_MODES; i++) {
+		if (!strcasecmp (arg, fit_names[i])) {
+			*fit = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
 static int nr_scales = 0;
 static long time_total_us = 0;
 
@@ -282,7 +302,8 @@ static void scale(
 	unsigned long h,
 	int x,	/* Center co-ordinates */
 	int y,
-	int src_fmt)
+	int src_fmt,
+	int fit)	/* shveu_fit_t, or -1 to zoom and pan */
 {
 	unsigned char *lcd_buf = display_get_back_buff_virt(display);
 	int lcd_w = display_get_width(display);
@@ -295,12 +316,15 @@ static void scale(
 	struct ren_vid_rect dst_sel;
 	struct timespec start;
 
+#ifdef BUNDLE_MODE
 	/* Clear the back buffer */
 	draw_rect_rgb565(lcd_buf, BLACK, 0, 0, lcd_w, lcd_h, lcd_w);
+#endif
 
 	src_surface.format = src_fmt;
 	src_surface.py = py;
 	src_surface.pc = pc;
+	src_surface.pcr = 0;
 	src_surface.pa = 0;
 	src_surface.w = w;
 	src_surface.h = h;
@@ -309,6 +333,7 @@ static void scale(
 	dst_surface.format = REN_RGB565;
 	dst_surface.py = lcd_buf;
 	dst_surface.pc = 0;
+	dst_surface.pcr = 0;
 	dst_surface.pa = 0;
 	dst_surface.w = lcd_w;
 	dst_surface.h = lcd_h;
@@ -320,6 +345,17 @@ static void scale(
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
 #ifndef BUNDLE_MODE
+	if (fit >= 0) {
+		/* Scale the whole image, clearing the borders around it */
+		shveu_fit(veu, &src_surface, &dst_surface, fit, 0xff000000);
+
+		time_total_us += elapsed_us(&start);
+		nr_scales++;
+
+		display_flip(display);
+		return;
+	}
+
 	src_sel.w = w;
 	src_sel.h = h;
 	src_sel.x = 0;
@@ -360,6 +396,9 @@ static void scale(
 
 	get_sel_surface(&src_surface2, &src_surface, &src_sel);
 	get_sel_surface(&dst_surface2, &dst_surface, &dst_sel);
+
+	/* Clear the back buffer around the scaled image */
+	shveu_fill_border(veu, &dst_surface, &dst_sel, 0xff000000);
 #endif	/* !BUNDLE_MODE */
 
 	shveu_setup(
@@ -413,6 +452,7 @@ int main (int argc, char * argv[])
 	float scale_factor=1.0;
 	int read_image = 1;
 	int x=0, y=0;
+	int fit = -1;
 	int key;
 	int run = 1;
 
@@ -422,7 +462,7 @@ int main (int argc, char * argv[])
 	int error = 0;
 
 	int c;
-	char * optstring = "hvc:s:W:H:";
+	char * optstring = "hvc:s:W:H:f:";
 
 #ifdef HAVE_GETOPT_LONG
 	static struct option long_options[] = {
@@ -432,6 +472,7 @@ int main (int argc, char * argv[])
 		{"input-size", required_argument, 0, 's'},
 		{"width", required_argument, 0, 'W'},
 		{"height", required_argument, 0, 'H'},
+		{"fit", required_argument, 0, 'f'},
 		{NULL,0,0,0}
 	};
 #endif
@@ -469,6 +510,12 @@ int main (int argc, char * argv[])
 		case 'H': /* input size */
 			input_h = strtoul(optarg, NULL, 10);
 			break;
+		case 'f': /* fit to the display */
+			if (set_fit (optarg, &fit) < 0) {
+				fprintf (stderr, "ERROR: Unknown fit mode %s\n", optarg);
+				error = 1;
+			}
+			break;
 		default:
 			break;
 		}
@@ -591,7 +638,7 @@ int main (int argc, char * argv[])
 			}
 		}
 
-		scale (veu, display, scale_factor, src_py, src_pc, input_w, input_h, x, y, input_colorspace);
+		scale (veu, display, scale_factor, src_py, src_pc, input_w, input_h, x, y, input_colorspace, fit);
 
 #ifdef HAVE_NCURSES
 		key = getch();
@@ -607,6 +654,11 @@ int main (int argc, char * argv[])
 			scale_factor = 1.0;
 			x = 0;
 			y = 0;
+			fit = -1;
+			break;
+		case 'f':
+			/* Cycle through the fit modes, then back to zoom & pan */
+			fit = (fit + 1 < NR_FIT_MODES) ? fit + 1 : -1;
 			break;
 		case KEY_UP:
 			y -= 1;
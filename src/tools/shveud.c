@@ -0,0 +1,475 @@
+/*
+ * libshveu: A library for controlling SH-Mobile VEU
+ * Copyright (C) 2009 Renesas Technology Corp.
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * shveud: owns all VEUs and runs the operations of libshveu clients,
+ * which connect when SHVEU_DAEMON is set in their environment.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <getopt.h>
+
+#include <uiomux/uiomux.h>
+#include "shveu/shveu.h"
+#include "shveud_proto.h"
+#include "veu_shm.h"
+
+#define MAX_CLIENTS 32
+
+struct client {
+	int fd;		/* non-blocking */
+	int pending;	/* jobs not yet replied to */
+	int closed;
+	struct shveud_request req;	/* request being received */
+	size_t have;			/* bytes of it received so far */
+};
+
+struct pending_job {
+	struct client *client;
+	uint32_t seq;
+};
+
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct client *clients[MAX_CLIENTS];
+static int nr_clients;
+
+static UIOMux *uiomux;
+static SHVEU_SCHED *sched;
+static int simulate;
+static volatile sig_atomic_t quit;
+
+static void
+usage (const char * progname)
+{
+	printf ("Usage: %s [options]\n", progname);
+	printf ("Run SH-Mobile VEU operations for libshveu clients.\n");
+	printf ("\n");
+	printf ("Clients connect when SHVEU_DAEMON is set in their environment, to\n");
+	printf ("the socket path or to " SHVEUD_SOCKET " if it is empty.\n");
+	printf ("\nOptions\n");
+	printf ("  -p, --socket path      Listen on path (default: " SHVEUD_SOCKET ")\n");
+	printf ("  -s, --simulate         Schedule requests, but complete them without using the VEUs\n");
+	printf ("  -t, --timeout ms       Reset a VEU that takes longer than ms (default: no timeout)\n");
+	printf ("  -r, --retries n        Retry an operation n times after a timeout (default: 1)\n");
+	printf ("  -h, --help             Display this help and exit\n");
+	printf ("  -v, --version          Output version information and exit\n");
+	printf ("\n");
+	printf ("Please report bugs to <linux-sh@vger.kernel.org>\n");
+}
+
+/* Called with clients_mutex held */
+static void client_put(struct client *c)
+{
+	if (c->closed && !c->pending)
+		free(c);
+}
+
+static void reply(struct client *c, uint32_t seq, shveu_job_status_t status)
+{
+	struct shveud_reply r;
+
+	r.magic = SHVEUD_MAGIC;
+	r.seq = seq;
+	r.status = status;
+
+	pthread_mutex_lock(&clients_mutex);
+	if (!c->closed && shveud_write_all(c->fd, &r, sizeof(r)) < 0) {
+		/* The client isn't reading its replies; the poll loop will see
+		 * the shutdown and drop it */
+		shutdown(c->fd, SHUT_RDWR);
+	}
+	c->pending--;
+	client_put(c);
+	pthread_mutex_unlock(&clients_mutex);
+}
+
+static void job_done(void *data, shveu_job_status_t status)
+{
+	struct pending_job *p = data;
+
+	reply(p->client, p->seq, status);
+	free(p);
+}
+
+/* Map a plane, checking that all of it is uiomux memory so that a client
+ * can't make the VEU access memory outside its buffers */
+static int map_plane(void **virt, uint32_t phys, size_t len)
+{
+	*virt = NULL;
+	if (!phys)
+		return 0;
+	if (simulate) {
+		/* Nothing is accessed */
+		*virt = (void *)(unsigned long)phys;
+		return 0;
+	}
+	*virt = veu_shm_map(uiomux, UIOMUX_SH_VEU, phys, len);
+	return *virt ? 0 : -1;
+}
+
+static int map_surface(struct ren_vid_surface *s, const struct shveud_surface *in)
+{
+	size_t len_y, len_c, len_a;
+
+	if (veu_shm_plane_sizes(in->format, in->w, in->h, in->pitch, &len_y, &len_c, &len_a) < 0)
+		return -1;
+
+	/* Every plane the VEU uses must be given */
+	if (!in->py
+	    || (fmts[in->format].c_bpp && !in->pc)
+	    || (is_planar(in->format) && !in->pcr))
+		return -1;
+
+	s->format = in->format;
+	s->w = in->w;
+	s->h = in->h;
+	s->pitch = in->pitch;
+	if (map_plane(&s->py, in->py, len_y) < 0
+	    || map_plane(&s->pa, in->pa, len_a) < 0)
+		return -1;
+
+	/* Planes the format doesn't have are ignored; for luma only surfaces,
+	 * the chroma the VEU needs is set up here */
+	if (fmts[in->format].c_bpp && map_plane(&s->pc, in->pc, len_c) < 0)
+		return -1;
+	if (is_planar(in->format) && map_plane(&s->pcr, in->pcr, len_c) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void handle_request(struct client *c, const struct shveud_request *req)
+{
+	struct shveu_job job;
+	struct pending_job *p;
+
+	pthread_mutex_lock(&clients_mutex);
+	c->pending++;
+	pthread_mutex_unlock(&clients_mutex);
+
+	memset(&job, 0, sizeof(job));
+	if (map_surface(&job.src, &req->src) < 0 || map_surface(&job.dst, &req->dst) < 0) {
+		reply(c, req->seq, SHVEU_JOB_FAILED);
+		return;
+	}
+
+	p = malloc(sizeof(*p));
+	if (!p) {
+		reply(c, req->seq, SHVEU_JOB_FAILED);
+		return;
+	}
+	p->client = c;
+	p->seq = req->seq;
+
+	job.filter_control = req->filter_control;
+	job.prio = req->prio;
+	if (job.prio < SHVEU_PRIO_BULK || job.prio >= SHVEU_NR_PRIO)
+		job.prio = SHVEU_PRIO_NORMAL;
+	job.deadline_us = req->deadline_us;
+	job.bt709 = req->bt709;
+	job.full_range = req->full_range;
+	job.done = job_done;
+	job.data = p;
+
+	if (shveu_sched_submit(sched, &job) < 0) {
+		free(p);
+		reply(c, req->seq, SHVEU_JOB_FAILED);
+	}
+}
+
+static void add_client(int fd)
+{
+	struct client *c;
+
+	if (nr_clients == MAX_CLIENTS) {
+		close(fd);
+		return;
+	}
+
+	/* A client that stops half way through a request mustn't block the
+	 * other clients */
+	c = calloc(1, sizeof(*c));
+	if (!c || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		free(c);
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	clients[nr_clients++] = c;
+}
+
+/* Read what has arrived of the next request of a client.
+ * Returns 1 when the request is complete, 0 if more is to come, or -1 if
+ * the client has gone or sent something other than a request. */
+static int read_request(struct client *c)
+{
+	ssize_t n;
+
+	n = read(c->fd, (char *)&c->req + c->have, sizeof(c->req) - c->have);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if (n <= 0)
+		return -1;
+
+	c->have += n;
+	if (c->have < sizeof(c->req))
+		return 0;
+
+	c->have = 0;
+	return (c->req.magic == SHVEUD_MAGIC) ? 1 : -1;
+}
+
+static void remove_client(int i)
+{
+	struct client *c = clients[i];
+
+	pthread_mutex_lock(&clients_mutex);
+	c->closed = 1;
+	close(c->fd);
+	client_put(c);
+	pthread_mutex_unlock(&clients_mutex);
+
+	clients[i] = clients[--nr_clients];
+}
+
+static int serve(const char *path)
+{
+	struct sockaddr_un addr;
+	struct pollfd fds[MAX_CLIENTS + 1];
+	int listen_fd;
+	int i, n;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(listen_fd, MAX_CLIENTS) < 0) {
+		close(listen_fd);
+		return -1;
+	}
+
+	while (!quit) {
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i=0; i<nr_clients; i++) {
+			fds[i+1].fd = clients[i]->fd;
+			fds[i+1].events = POLLIN;
+		}
+		n = nr_clients;
+
+		if (poll(fds, n + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* Backwards, so that removing a client doesn't skip one */
+		for (i=n-1; i>=0; i--) {
+			int ret;
+
+			if (!fds[i+1].revents)
+				continue;
+			while ((ret = read_request(clients[i])) == 1)
+				handle_request(clients[i], &clients[i]->req);
+			if (ret < 0)
+				remove_client(i);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd >= 0)
+				add_client(fd);
+		}
+	}
+
+	while (nr_clients)
+		remove_client(nr_clients - 1);
+	close(listen_fd);
+	unlink(path);
+
+	return 0;
+}
+
+static void handle_signal(int sig)
+{
+	quit = 1;
+}
+
+int main (int argc, char * argv[])
+{
+	SHVEU *veus[8];
+	char **names;
+	int nr_veus = 0;
+	int nr_names;
+	char * progname;
+	const char * path = SHVEUD_SOCKET;
+	int show_version = 0;
+	int show_help = 0;
+	int timeout_ms = 0;
+	int retries = 1;
+	int ret = 1;
+	int i, c;
+	char * optstring = "hvp:st:r:";
+	struct sigaction sa;
+
+#ifdef HAVE_GETOPT_LONG
+	static struct option long_options[] = {
+		{"help", no_argument, 0, 'h'},
+		{"version", no_argument, 0, 'v'},
+		{"socket", required_argument, 0, 'p'},
+		{"simulate", no_argument, 0, 's'},
+		{"timeout", required_argument, 0, 't'},
+		{"retries", required_argument, 0, 'r'},
+		{NULL,0,0,0}
+	};
+#endif
+
+	progname = argv[0];
+
+	while (1) {
+#ifdef HAVE_GETOPT_LONG
+		c = getopt_long (argc, argv, optstring, long_options, NULL);
+#else
+		c = getopt (argc, argv, optstring);
+#endif
+		if (c == -1) break;
+
+		switch (c) {
+		case 'h': /* help */
+			show_help = 1;
+			break;
+		case 'v': /* version */
+			show_version = 1;
+			break;
+		case 'p': /* socket path */
+			path = optarg;
+			break;
+		case 's': /* simulated backend */
+			simulate = 1;
+			break;
+		case 't': /* hang timeout */
+			timeout_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'r': /* retries after a hang */
+			retries = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage (progname);
+			return 1;
+		}
+	}
+
+	if (show_version)
+		printf ("%s version " VERSION "\n", progname);
+	if (show_help)
+		usage (progname);
+	if (show_version || show_help)
+		return 0;
+
+	/* The daemon itself must use the VEUs directly */
+	unsetenv("SHVEU_DAEMON");
+
+	if (!simulate) {
+		uiomux = uiomux_open();
+		if (!uiomux) {
+			fprintf (stderr, "%s: Can't open UIOMux\n", progname);
+			return 1;
+		}
+
+		if (shveu_list_veu(&names, &nr_names) < 0) {
+			fprintf (stderr, "%s: Can't get a list of VEU available\n", progname);
+			goto exit_uiomux;
+		}
+
+		for (i=0; i<nr_names && nr_veus<8; i++) {
+			veus[nr_veus] = shveu_open_named(names[i]);
+			if (veus[nr_veus]) {
+				shveu_set_timeout(veus[nr_veus], timeout_ms, retries);
+				nr_veus++;
+			}
+		}
+		if (!nr_veus) {
+			fprintf (stderr, "%s: Can't open any VEU\n", progname);
+			goto exit_uiomux;
+		}
+
+	} else {
+		/* Jobs are scheduled as usual, but not run */
+		veus[nr_veus++] = NULL;
+	}
+
+	sched = shveu_sched_new(veus, nr_veus);
+	if (!sched) {
+		fprintf (stderr, "%s: Can't create the scheduler\n", progname);
+		goto exit_veus;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (serve(path) < 0)
+		fprintf (stderr, "%s: Can't listen on %s\n", progname, path);
+	else
+		ret = 0;
+
+	if (sched)
+		shveu_sched_free(sched);
+exit_veus:
+	for (i=0; i<nr_veus; i++) {
+		if (veus[i])
+			shveu_close(veus[i]);
+	}
+exit_uiomux:
+	if (uiomux)
+		uiomux_close(uiomux);
+
+	return ret;
+}
@@ -28,6 +28,19 @@ for f in 0x0 0x1 0x2 0x30 0x10 0x20 0x11 0x21; do \
   done; \
 done
 
+# Check operations go through shveud, using the simulated backend
+shveud --simulate -p /tmp/shveud-test.sock &
+SHVEUD_PID=$!
+sleep 1
+for src in 888 rgb yuv x888; do \
+  for dst in 888 rgb yuv x888; do \
+    SHVEU_DAEMON=/tmp/shveud-test.sock \
+      shveu-convert -s vga -S qvga vga.${src} out_daemon_${src}.${dst} \
+      || echo "shveud: ${src} to ${dst} failed"; \
+  done; \
+done
+kill ${SHVEUD_PID}
+
 # HOST: Convert RGB24 files to png using ImageMagick
 cp /tftpboot/rootfs/root/*.888 .
 rename "s/888$/rgb/" *